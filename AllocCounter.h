@@ -0,0 +1,17 @@
+#ifndef __CV_ALLOC_COUNTER_H__
+#define __CV_ALLOC_COUNTER_H__
+
+#include <stddef.h>
+
+// Counts heap allocations made anywhere in the process (OpenCV's cv::Mat
+// buffers included), for benchmarks and tests that care about allocation
+// behavior. Just link AllocCounter.cpp in; it replaces the allocator entry
+// points with counting wrappers.
+//
+// On glibc this interposes malloc and friends, so everything is counted. On
+// other platforms only operator new is counted, which misses cv::Mat data.
+
+// Total allocations since the process started
+size_t allocationCount();
+
+#endif
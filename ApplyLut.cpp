@@ -0,0 +1,97 @@
+// Batch counterpart to color_balance: apply a color LUT saved by it (or
+// built with ColorPipeline) to any number of images without a display.
+//
+// Options add more per-pixel ops around the LUT; they are all baked into a
+// single LUT with it, so the images still only get one pass each (plus one
+// to count the histogram with -e).
+
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ColorLut.h"
+#include "RawImage.h"
+
+static void usage(const std::string &program) {
+    std::cerr << "Usage: " << program << " [options] [LUT file] "
+              << "[input image] [output image] ...\n"
+              << "  -w [b,g,r]   White balance before the LUT: this color "
+              << "comes out neutral\n"
+              << "  -s [amount]  Saturation after the LUT (0 is gray, 1 "
+              << "unchanged)\n"
+              << "  -e           Equalize each image after the rest, with "
+              << "the histogram of\n"
+              << "               its balanced version\n";
+}
+
+int main(int argc, char *argv[]) {
+    bool equalize = false;
+    bool whiteBalance = false;
+    cv::Vec3f white;
+    float saturation = 1;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-e") == 0) {
+            equalize = true;
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            saturation = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc &&
+                   sscanf(argv[arg+1], "%f,%f,%f", &white[0], &white[1],
+                          &white[2]) == 3) {
+            whiteBalance = true;
+            arg++;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - arg < 3 || (argc - arg) % 2 != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ColorLut lut;
+    if (!lut.load(argv[arg])) {
+        std::cerr << "load: " << argv[arg] << ": no LUT there\n";
+        return 1;
+    }
+
+    ColorPipeline pipeline;
+    if (whiteBalance) {
+        pipeline.then(whiteBalanceOp(white));
+    }
+    pipeline.then(lut);
+    if (saturation != 1) {
+        pipeline.then(saturationOp(saturation));
+    }
+    // Without equalization the whole chain is the same for every image;
+    // with it, the curve depends on each image's histogram.
+    if (whiteBalance || saturation != 1) {
+        lut = pipeline.bake(lut.size());
+    }
+
+    int failures = 0;
+    cv::Mat result;
+    RawImage raw;
+    for (int i = arg + 1; i < argc; i += 2) {
+        cv::Mat image = readImage(argv[i], raw);
+        if (!image.data) {
+            std::cerr << "readImage: " << argv[i] << ": didn't work out\n";
+            failures++;
+            continue;
+        }
+        if (equalize) {
+            equalizedLut(pipeline, image, lut.size()).apply(image, result);
+        } else {
+            lut.apply(image, result);
+        }
+        if (!cv::imwrite(argv[i+1], result)) {
+            std::cerr << "imwrite: " << argv[i+1] << ": didn't work out\n";
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}
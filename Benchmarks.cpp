@@ -0,0 +1,553 @@
+// Benchmarks for the hot paths: every operator runs over the bundled test
+// images and over synthetic images at a few resolutions.
+//
+// Each case is warmed up first (those runs are thrown away), then timed
+// until it has enough samples or runs out of time budget. Results are
+// printed as a table and optionally written as JSON, which can be fed back
+// in later as a baseline to catch regressions:
+//
+//   ./benchmarks --json baseline.json
+//   ... change stuff ...
+//   ./benchmarks --baseline baseline.json --threshold 0.1
+//
+// At the end, the corners found with compact intermediate storage (see
+// InterestWorkspace) are compared against the float ones, per image.
+//
+// The JSON records whether the build had tracing (see Trace.h). Comparing a
+// TRACING=ON build against a baseline from a TRACING=OFF one also prints
+// what the trace scopes cost overall:
+//
+//   (TRACING=OFF build) ./benchmarks --json untraced.json
+//   (TRACING=ON build)  ./benchmarks --baseline untraced.json
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "AllocCounter.h"
+#include "ColorBalance.h"
+#include "Filter.h"
+#include "Histogram.h"
+#include "InterestPoints.h"
+#include "RawImage.h"
+#include "Smoothing.h"
+
+#ifndef TEST_IMAGES_DIR
+#define TEST_IMAGES_DIR "../test_images"
+#endif
+
+#define WARMUP_RUNS  1
+#define MIN_SAMPLES  3
+#define MAX_SAMPLES  25
+#define TIME_BUDGET  1.0 // seconds of timed runs per case (after MIN_SAMPLES)
+
+struct Operator {
+    std::string name;
+    std::function<size_t(const cv::Mat &)> run; // returns something to keep
+};
+
+struct Input {
+    std::string name;
+    cv::Mat image;
+    std::shared_ptr<RawImage> raw; // keeps image mapped, for raw files
+};
+
+struct Result {
+    std::string name;
+    int width;
+    int height;
+    int samples;
+    double medianMs;
+    double p10Ms;
+    double p90Ms;
+    double minMs;
+    double pixelsPerSec;
+    double allocsPerRun;
+};
+
+// Keeps the compiler from deciding results aren't needed
+static volatile size_t sink;
+
+#ifdef CV_TRACING
+static const bool tracing = true;
+#else
+static const bool tracing = false;
+#endif
+
+static std::vector<Operator> operators() {
+    std::vector<Operator> ops;
+    cv::Mat gauss5 = gaussianKernel(cv::Size(5, 5));
+    cv::Mat gauss11 = gaussianKernel(cv::Size(11, 11), 2);
+    cv::Mat gauss17 = gaussianKernel(cv::Size(17, 17), 3);
+    cv::Mat unsharp5 = unsharpKernel(cv::Size(5, 5));
+    ops.push_back({ "filter_separable_3x3", [](const cv::Mat &image) {
+        return filter(image, cv::Vec3i(1, 2, 1), cv::Vec3i(1, 2, 1)).total();
+    }});
+    ops.push_back({ "filter_gaussian_5x5", [gauss5](const cv::Mat &image) {
+        return filter(image, gauss5).total();
+    }});
+    ops.push_back({ "filter_gaussian_11x11", [gauss11](const cv::Mat &image) {
+        return filter(image, gauss11).total();
+    }});
+    ops.push_back({ "filter_gaussian_17x17", [gauss17](const cv::Mat &image) {
+        return filter(image, gauss17).total();
+    }});
+    // Not separable, so this one takes the 2D path
+    ops.push_back({ "filter_unsharp_5x5", [unsharp5](const cv::Mat &image) {
+        return filter(image, unsharp5).total();
+    }});
+    // Same, reusing the destination and scratch buffers between runs
+    std::shared_ptr<FilterWorkspace> filterWorkspace(new FilterWorkspace);
+    std::shared_ptr<cv::Mat> filtered(new cv::Mat);
+    ops.push_back({ "filter_gaussian_5x5_workspace",
+                    [gauss5, filterWorkspace, filtered](const cv::Mat &image) {
+        filter(image, gauss5, *filtered, *filterWorkspace);
+        return filtered->total();
+    }});
+    // Cost shouldn't depend on the radius
+    ops.push_back({ "median_r2", [](const cv::Mat &image) {
+        return medianFilter(image, 2).total();
+    }});
+    ops.push_back({ "median_r16", [](const cv::Mat &image) {
+        return medianFilter(image, 16).total();
+    }});
+    ops.push_back({ "bilateral_grid", [](const cv::Mat &image) {
+        return bilateralGrid(image, 16, 20).total();
+    }});
+    ops.push_back({ "sobel", [](const cv::Mat &image) {
+        return sobel(image).total();
+    }});
+    std::shared_ptr<FilterWorkspace> compactFilter(new FilterWorkspace);
+    compactFilter->compact = true;
+    ops.push_back({ "sobel_compact",
+                    [compactFilter, filtered](const cv::Mat &image) {
+        sobel(image, *filtered, *compactFilter);
+        return filtered->total();
+    }});
+    ops.push_back({ "harris", [](const cv::Mat &image) {
+        return harris(image).size();
+    }});
+    std::shared_ptr<InterestWorkspace> interestWorkspace(
+        new InterestWorkspace);
+    std::shared_ptr<PointVector> points(new PointVector);
+    ops.push_back({ "harris_workspace",
+                    [interestWorkspace, points](const cv::Mat &image) {
+        harris(image, *points, *interestWorkspace);
+        return points->size();
+    }});
+    std::shared_ptr<InterestWorkspace> compactInterest(new InterestWorkspace);
+    compactInterest->compact = true;
+    ops.push_back({ "harris_compact",
+                    [compactInterest, points](const cv::Mat &image) {
+        harris(image, *points, *compactInterest);
+        return points->size();
+    }});
+    std::shared_ptr<Graph> graph(new Graph);
+    ops.push_back({ "harris_graph", [graph](const cv::Mat &image) {
+        return harris(image, *graph).size();
+    }});
+    ops.push_back({ "moravec", [](const cv::Mat &image) {
+        return moravec(image).size();
+    }});
+    ops.push_back({ "moravec_compact",
+                    [compactInterest, points](const cv::Mat &image) {
+        moravec(image, *points, *compactInterest);
+        return points->size();
+    }});
+    ops.push_back({ "histogram", [](const cv::Mat &image) {
+        return Histogram(image).blue[128];
+    }});
+    ops.push_back({ "equal_histogram", [](const cv::Mat &image) {
+        return equalHistogram(image).total();
+    }});
+    // What color_balance's updateImage does per slider move, minus imshow
+    ops.push_back({ "color_balance", [](const cv::Mat &image) {
+        cv::Vec3f factor(0.9f, 1.0f, 1.2f);
+        return colorBalanceLut(factor).apply(image).total();
+    }});
+    return ops;
+}
+
+static std::vector<Input> inputs(const std::string &imageDir) {
+    std::vector<Input> result;
+    std::vector<cv::String> files;
+    cv::glob(imageDir + "/*", files);
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size(); i++) {
+        std::shared_ptr<RawImage> raw(new RawImage);
+        cv::Mat image = readImage(files[i], *raw);
+        if (!image.data) {
+            continue;
+        }
+        std::string name = files[i];
+        name = name.substr(name.find_last_of('/') + 1);
+        result.push_back({ name, image, raw });
+    }
+    if (result.empty()) {
+        std::cerr << "warning: no images found in " << imageDir << "\n";
+    }
+
+    // Synthetic: smooth gradients plus noise, so there's something for the
+    // corner detectors to find and the histogram isn't degenerate.
+    cv::Size sizes[] = {
+        cv::Size(160, 120), cv::Size(320, 240), cv::Size(640, 480)
+    };
+    for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        cv::Mat image(sizes[i], CV_8UC3);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(64));
+        for (int y = 0; y < image.rows; y++) {
+            for (int x = 0; x < image.cols; x++) {
+                cv::Vec3b &p = image.at<cv::Vec3b>(y, x);
+                p[0] += (x * 191) / image.cols;
+                p[1] += (y * 191) / image.rows;
+                p[2] += ((x / 16 + y / 16) % 2) * 191;
+            }
+        }
+        std::ostringstream name;
+        name << "synthetic_" << sizes[i].width << "x" << sizes[i].height;
+        result.push_back({ name.str(), image, nullptr });
+    }
+    return result;
+}
+
+// Points found by a detector in both modes, and by only one of them
+static void compareCorners(const PointVector &full, const PointVector &compact,
+                           size_t &common, size_t &differ) {
+    PointVector a(full), b(compact), both;
+    auto less = [](const cv::Point &p, const cv::Point &q) {
+        return p.y < q.y || (p.y == q.y && p.x < q.x);
+    };
+    std::sort(a.begin(), a.end(), less);
+    std::sort(b.begin(), b.end(), less);
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                          std::back_inserter(both), less);
+    common = both.size();
+    differ = a.size() + b.size() - 2 * both.size();
+}
+
+// How much the compact storage mode changes the Harris and Moravec corners
+static void reportCompactAccuracy(const std::vector<Input> &images,
+                                  const std::string &only) {
+    InterestWorkspace full, compact;
+    compact.compact = true;
+    bool header = false;
+    for (size_t i = 0; i < images.size(); i++) {
+        const char *detectors[] = { "harris", "moravec" };
+        for (int d = 0; d < 2; d++) {
+            std::string name = std::string(detectors[d]) + "_compact/" +
+                               images[i].name;
+            if (!only.empty() && name.find(only) == std::string::npos) {
+                continue;
+            }
+            PointVector a, b;
+            if (d == 0) {
+                harris(images[i].image, a, full);
+                harris(images[i].image, b, compact);
+            } else {
+                moravec(images[i].image, a, full);
+                moravec(images[i].image, b, compact);
+            }
+            size_t common, differ;
+            compareCorners(a, b, common, differ);
+            if (!header) {
+                printf("\n%-44s %9s %9s\n", "compact vs. float corners",
+                       "common", "differ");
+                header = true;
+            }
+            printf("%-44s %9zu %9zu\n", name.c_str(), common, differ);
+        }
+    }
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+    double position = p * (sorted.size() - 1);
+    size_t lo = (size_t)position;
+    size_t hi = std::min(lo + 1, sorted.size() - 1);
+    double t = position - lo;
+    return sorted[lo] * (1 - t) + sorted[hi] * t;
+}
+
+static Result measure(const Operator &op, const Input &input) {
+    typedef std::chrono::steady_clock Clock;
+    for (int i = 0; i < WARMUP_RUNS; i++) {
+        sink = op.run(input.image);
+    }
+
+    std::vector<double> samples;
+    double elapsed = 0;
+    size_t allocsBefore = allocationCount();
+    while ((int)samples.size() < MIN_SAMPLES ||
+           ((int)samples.size() < MAX_SAMPLES && elapsed < TIME_BUDGET)) {
+        Clock::time_point start = Clock::now();
+        sink = op.run(input.image);
+        std::chrono::duration<double> duration = Clock::now() - start;
+        samples.push_back(duration.count() * 1000);
+        elapsed += duration.count();
+    }
+    size_t allocs = allocationCount() - allocsBefore;
+    std::sort(samples.begin(), samples.end());
+
+    Result result;
+    result.name = op.name + "/" + input.name;
+    result.width = input.image.cols;
+    result.height = input.image.rows;
+    result.samples = samples.size();
+    result.medianMs = percentile(samples, 0.5);
+    result.p10Ms = percentile(samples, 0.1);
+    result.p90Ms = percentile(samples, 0.9);
+    result.minMs = samples[0];
+    result.pixelsPerSec = input.image.total() / (result.medianMs / 1000);
+    result.allocsPerRun = (double)allocs / samples.size();
+    return result;
+}
+
+// How much faster the fused Harris graph is than harris() with and without
+// a workspace, per image (a ratio over 1 means the graph is faster)
+static void reportFusedSpeedup(const std::vector<Result> &results) {
+    std::map<std::string, double> medians;
+    for (size_t i = 0; i < results.size(); i++) {
+        medians[results[i].name] = results[i].medianMs;
+    }
+    const std::string prefix = "harris_graph/";
+    bool header = false;
+    for (size_t i = 0; i < results.size(); i++) {
+        const std::string &name = results[i].name;
+        if (name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        std::string image = name.substr(prefix.size());
+        std::map<std::string, double>::const_iterator plain =
+            medians.find("harris/" + image);
+        std::map<std::string, double>::const_iterator workspace =
+            medians.find("harris_workspace/" + image);
+        if (plain == medians.end() || workspace == medians.end()) {
+            continue;
+        }
+        if (!header) {
+            printf("\n%-44s %9s %9s\n", "harris_graph speedup vs.",
+                   "harris", "workspace");
+            header = true;
+        }
+        printf("%-44s %8.2fx %8.2fx\n", name.c_str(),
+               plain->second / results[i].medianMs,
+               workspace->second / results[i].medianMs);
+    }
+}
+
+// Benchmark names include image file names, which can contain anything
+static std::string jsonEscape(const std::string &text) {
+    std::string escaped;
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Undoes jsonEscape, starting just past an opening quote; stops at the
+// closing one
+static std::string jsonUnescape(const std::string &line, size_t start) {
+    std::string text;
+    for (size_t i = start; i < line.size() && line[i] != '"'; i++) {
+        if (line[i] != '\\' || i + 1 >= line.size()) {
+            text += line[i];
+        } else if (line[i+1] == 'u') {
+            text += (char)strtol(line.substr(i + 2, 4).c_str(), 0, 16);
+            i += 5;
+        } else {
+            text += line[++i];
+        }
+    }
+    return text;
+}
+
+// One benchmark per line, so that reading a baseline back doesn't need a
+// real JSON parser.
+static bool writeJson(const std::string &path,
+                      const std::vector<Result> &results) {
+    std::ofstream out(path.c_str());
+    if (!out) {
+        return false;
+    }
+    out << "{\n  \"tracing\": " << (tracing ? "true" : "false") << ",\n"
+        << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        out << "    {\"name\": \"" << jsonEscape(r.name) << "\", "
+            << "\"width\": " << r.width << ", "
+            << "\"height\": " << r.height << ", "
+            << "\"samples\": " << r.samples << ", "
+            << "\"median_ms\": " << r.medianMs << ", "
+            << "\"p10_ms\": " << r.p10Ms << ", "
+            << "\"p90_ms\": " << r.p90Ms << ", "
+            << "\"min_ms\": " << r.minMs << ", "
+            << "\"pixels_per_sec\": " << r.pixelsPerSec << ", "
+            << "\"allocs_per_run\": " << r.allocsPerRun << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return (bool)out;
+}
+
+// Median time per benchmark name, from a file written by writeJson, and
+// whether that build had tracing
+static std::map<std::string, double> readBaseline(const std::string &path,
+                                                  bool &baselineTracing) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(path.c_str());
+    std::string line;
+    const std::string tracingKey = "\"tracing\": ";
+    const std::string nameKey = "\"name\": \"";
+    const std::string medianKey = "\"median_ms\": ";
+    baselineTracing = false;
+    while (std::getline(in, line)) {
+        size_t tracingValue = line.find(tracingKey);
+        if (tracingValue != std::string::npos) {
+            baselineTracing =
+                line.compare(tracingValue + tracingKey.size(), 4, "true") == 0;
+            continue;
+        }
+        size_t name = line.find(nameKey);
+        size_t median = line.find(medianKey);
+        if (name == std::string::npos || median == std::string::npos) {
+            continue;
+        }
+        std::string key = jsonUnescape(line, name + nameKey.size());
+        baseline[key] = strtod(line.c_str() + median + medianKey.size(), 0);
+    }
+    return baseline;
+}
+
+static void usage(const std::string &program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --images [dir]       Image directory (default "
+              << TEST_IMAGES_DIR << ")\n"
+              << "  --only [substring]   Only run benchmarks whose name "
+              << "contains substring\n"
+              << "  --json [path]        Write results as JSON\n"
+              << "  --baseline [path]    Compare against earlier JSON\n"
+              << "  --threshold [ratio]  Allowed slowdown vs. baseline "
+              << "(default 0.1)\n";
+}
+
+int main(int argc, char *argv[]) {
+    std::string imageDir = TEST_IMAGES_DIR;
+    std::string only, jsonPath, baselinePath;
+    double threshold = 0.1;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--images") == 0) {
+            imageDir = argv[++i];
+        } else if (strcmp(argv[i], "--only") == 0) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0) {
+            jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0) {
+            threshold = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    bool baselineTracing = tracing;
+    if (!baselinePath.empty()) {
+        baseline = readBaseline(baselinePath, baselineTracing);
+        if (baseline.empty()) {
+            std::cerr << "No baseline results in " << baselinePath << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<Operator> ops = operators();
+    std::vector<Input> images = inputs(imageDir);
+    std::vector<Result> results;
+    std::vector<double> changes; // vs. baseline, per benchmark
+    int regressions = 0;
+    printf("%-44s %9s %9s %9s %10s %9s\n", "benchmark", "median ms",
+           "p10 ms", "p90 ms", "Mpix/s", "allocs");
+    for (size_t o = 0; o < ops.size(); o++) {
+        for (size_t i = 0; i < images.size(); i++) {
+            if (!only.empty() &&
+                (ops[o].name + "/" + images[i].name).find(only) ==
+                std::string::npos) {
+                continue;
+            }
+            Result r = measure(ops[o], images[i]);
+            results.push_back(r);
+            printf("%-44s %9.3f %9.3f %9.3f %10.2f %9.1f", r.name.c_str(),
+                   r.medianMs, r.p10Ms, r.p90Ms, r.pixelsPerSec / 1e6,
+                   r.allocsPerRun);
+            std::map<std::string, double>::const_iterator base =
+                baseline.find(r.name);
+            if (base != baseline.end()) {
+                double change = r.medianMs / base->second - 1;
+                changes.push_back(change);
+                printf("  %+6.1f%%", change * 100);
+                if (change > threshold) {
+                    printf("  REGRESSION");
+                    regressions++;
+                }
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    reportCompactAccuracy(images, only);
+    reportFusedSpeedup(results);
+
+    if (baselineTracing != tracing && !changes.empty()) {
+        // Per-benchmark noise goes both ways, so the median is the number
+        // to look at; the extremes show how noisy this run was.
+        std::sort(changes.begin(), changes.end());
+        if (!tracing) {
+            for (size_t i = 0; i < changes.size(); i++) {
+                changes[i] = 1 / (1 + changes[i]) - 1;
+            }
+            std::reverse(changes.begin(), changes.end());
+        }
+        printf("\nTracing overhead over %zu benchmarks: median %+.2f%%, "
+               "p10 %+.2f%%, p90 %+.2f%%\n", changes.size(),
+               percentile(changes, 0.5) * 100, percentile(changes, 0.1) * 100,
+               percentile(changes, 0.9) * 100);
+    }
+
+    if (!jsonPath.empty() && !writeJson(jsonPath, results)) {
+        std::cerr << "Couldn't write " << jsonPath << "\n";
+        return 1;
+    }
+    if (regressions) {
+        printf("%d benchmark(s) regressed more than %.0f%%\n", regressions,
+               threshold * 100);
+        return 1;
+    }
+    return 0;
+}
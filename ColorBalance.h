@@ -0,0 +1,12 @@
+#ifndef __CV_COLOR_BALANCE_H__
+#define __CV_COLOR_BALANCE_H__
+
+#include <opencv2/opencv.hpp>
+
+#include "ColorLut.h"
+
+// LUT that multiplies each channel by the matching (BGR) factor, in gamma
+// space if the color_balance tool is configured to do that.
+ColorLut colorBalanceLut(cv::Vec3f factor);
+
+#endif
@@ -0,0 +1,85 @@
+// Ex 3.1: Color balance (the interactive part; see ColorBalance.cpp)
+
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+
+#include "ColorBalance.h"
+#include "RawImage.h"
+
+#define WINDOW_NAME "Color Balance"
+#define SLIDER_NAME_R "Red Multiplier (x100)"
+#define SLIDER_NAME_G "Green Multiplier (x100)"
+#define SLIDER_NAME_B "Blue Multiplier (x100)"
+
+struct ColorBalanceData {
+    cv::Mat originalImage;
+    int percentB;
+    int percentG;
+    int percentR;
+    ColorLut lut;
+};
+
+// 'percent' parameter is discarded and the three percent values in data are
+// used instead.
+void updateImage(int percent, void *untypedData) {
+    ColorBalanceData *data = static_cast<ColorBalanceData *>(untypedData);
+    cv::Mat displayImage;
+
+    // Create the channel-wise (BGR) scale factor vector
+    cv::Vec3f factor((float) data->percentB / 100,
+                     (float) data->percentG / 100,
+                     (float) data->percentR / 100);
+
+    data->lut = colorBalanceLut(factor);
+    data->lut.apply(data->originalImage, displayImage);
+    cv::imshow(WINDOW_NAME, displayImage);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " [image file] [LUT file]\n"
+                  << "The LUT file (optional) receives the final color "
+                  << "balance, for use with apply_lut.\n";
+        return 1;
+    }
+
+    RawImage raw;
+    cv::Mat image = readImage(argv[1], raw);
+    if (!image.data) {
+        std::cerr << "readImage: " << argv[1] << ": didn't work out\n";
+        return 1;
+    }
+
+    std::cout << "Press ESC in the window to quit.\n";
+    cv::imshow(WINDOW_NAME, image);
+
+    // Using percent since we're stuck with integers in the highgui trackbar
+    ColorBalanceData data = { image, 100, 100, 100, ColorLut() };
+    cv::namedWindow(WINDOW_NAME, cv::WINDOW_AUTOSIZE);
+    cv::createTrackbar(SLIDER_NAME_R, WINDOW_NAME, &data.percentR, 200,
+                       updateImage, &data);
+    cv::createTrackbar(SLIDER_NAME_G, WINDOW_NAME, &data.percentG, 200,
+                       updateImage, &data);
+    cv::createTrackbar(SLIDER_NAME_B, WINDOW_NAME, &data.percentB, 200,
+                       updateImage, &data);
+    for (;;) {
+        // Everything happens in updateImage from here out.
+        if (cv::waitKey(0) == 27) {
+            break;
+        }
+    }
+
+    if (argc == 3) {
+        if (data.lut.empty()) {
+            // Sliders never moved, so the balance is the identity
+            data.lut = ColorPipeline().bake();
+        }
+        if (!data.lut.save(argv[2])) {
+            std::cerr << "Couldn't save LUT to " << argv[2] << "\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,319 @@
+#include "ColorLut.h"
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+ColorLut::ColorLut() : size_(0) {
+}
+
+ColorLut::ColorLut(const ColorOp &op, int size) : size_(size) {
+    if (size_ < 2) {
+        std::cerr << "ColorLut needs at least 2 lattice points per axis\n";
+        size_ = 2;
+    }
+    table.resize(size_ * size_ * size_ * 4);
+    float step = 255.0f / (size_ - 1);
+    float *node = &table[0];
+    for (int r = 0; r < size_; r++) {
+        for (int g = 0; g < size_; g++) {
+            for (int b = 0; b < size_; b++) {
+                cv::Vec3f out = op(cv::Vec3f(b * step, g * step, r * step));
+                node[0] = out[0];
+                node[1] = out[1];
+                node[2] = out[2];
+                node[3] = 0;
+                node += 4;
+            }
+        }
+    }
+    computeOffsets();
+}
+
+void ColorLut::computeOffsets() {
+    float scale = (float)(size_ - 1) / 255;
+    for (int v = 0; v < 256; v++) {
+        // Clamp so that 255 lands at the top of the last cell instead of the
+        // bottom of a cell that doesn't exist.
+        int cell = std::min((int)(v * scale), size_ - 2);
+        fraction[v] = v * scale - cell;
+        offsetB[v] = cell * 4;
+        offsetG[v] = cell * size_ * 4;
+        offsetR[v] = cell * size_ * size_ * 4;
+    }
+}
+
+#ifndef __SSE2__
+// Same as the SSE path: clamped before rounding, since saturate_cast goes
+// through int and would wrap values past int range (NaN comes out 0)
+static inline uchar clampToByte(float v) {
+    v = v > 0 ? v : 0;
+    return cv::saturate_cast<uchar>(std::min(v, 255.0f));
+}
+#endif
+
+cv::Mat ColorLut::apply(const cv::Mat &image) const {
+    cv::Mat result;
+    apply(image, result);
+    return result;
+}
+
+// Tetrahedral interpolation: the unit cube around the input color is split
+// into six tetrahedra along its main diagonal, and the one containing the
+// color is picked by ordering the fractional parts. Only four lattice nodes
+// are read (trilinear needs eight) and the result is exact for any op that
+// is linear inside the cube.
+inline void ColorLut::lookup(const uchar *src, uchar *out) const {
+    const int sB = 4;
+    const int sG = size_ * 4;
+    const int sR = size_ * size_ * 4;
+    const float *c0 = &table[0] + offsetB[src[0]] + offsetG[src[1]] +
+                      offsetR[src[2]];
+    float fb = fraction[src[0]];
+    float fg = fraction[src[1]];
+    float fr = fraction[src[2]];
+    // f1 >= f2 >= f3, s1 is the corner one step along the largest axis, s2
+    // the corner one step along the two largest.
+    float f1, f2, f3;
+    int s1, s2;
+    if (fr >= fg) {
+        if (fg >= fb) {
+            f1 = fr; f2 = fg; f3 = fb; s1 = sR; s2 = sR + sG;
+        } else if (fr >= fb) {
+            f1 = fr; f2 = fb; f3 = fg; s1 = sR; s2 = sR + sB;
+        } else {
+            f1 = fb; f2 = fr; f3 = fg; s1 = sB; s2 = sB + sR;
+        }
+    } else {
+        if (fr >= fb) {
+            f1 = fg; f2 = fr; f3 = fb; s1 = sG; s2 = sG + sR;
+        } else if (fg >= fb) {
+            f1 = fg; f2 = fb; f3 = fr; s1 = sG; s2 = sG + sB;
+        } else {
+            f1 = fb; f2 = fg; f3 = fr; s1 = sB; s2 = sB + sG;
+        }
+    }
+    const float *c1 = c0 + s1;
+    const float *c2 = c0 + s2;
+    const float *c3 = c0 + sB + sG + sR;
+#ifdef __SSE2__
+    // All three channels (plus padding) at once
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(c0), _mm_set1_ps(1 - f1));
+    v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(c1), _mm_set1_ps(f1 - f2)));
+    v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(c2), _mm_set1_ps(f2 - f3)));
+    v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(c3), _mm_set1_ps(f3)));
+    // Clamp first: the convert turns NaN and anything past int range into
+    // INT_MIN, which packs to 0. max takes its second operand when v is NaN,
+    // so NaN becomes 0 (as in clampToByte).
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255));
+    __m128i i = _mm_cvtps_epi32(v);
+    i = _mm_packs_epi32(i, i);
+    i = _mm_packus_epi16(i, i);
+    int packed = _mm_cvtsi128_si32(i);
+    out[0] = (uchar)packed;
+    out[1] = (uchar)(packed >> 8);
+    out[2] = (uchar)(packed >> 16);
+#else
+    for (int c = 0; c < 3; c++) {
+        out[c] = clampToByte((1 - f1) * c0[c] + (f1 - f2) * c1[c] +
+                             (f2 - f3) * c2[c] + f3 * c3[c]);
+    }
+#endif
+}
+
+void ColorLut::apply(const cv::Mat &image, cv::Mat &dst) const {
+    if (image.type() != CV_8UC3) {
+        std::cerr << "ColorLut::apply only supports 8UC3 images\n";
+        image.copyTo(dst);
+        return;
+    }
+    if (table.empty()) {
+        image.copyTo(dst);
+        return;
+    }
+    dst.create(image.size(), CV_8UC3);
+    for (int y = 0; y < image.rows; y++) {
+        const uchar *src = image.ptr<uchar>(y);
+        uchar *out = dst.ptr<uchar>(y);
+        for (int x = 0; x < image.cols; x++, src += 3, out += 3) {
+            lookup(src, out);
+        }
+    }
+}
+
+Histogram ColorLut::histogram(const cv::Mat &image) const {
+    if (image.type() != CV_8UC3 || table.empty()) {
+        return Histogram(image);
+    }
+    Histogram h;
+    for (int y = 0; y < image.rows; y++) {
+        const uchar *src = image.ptr<uchar>(y);
+        for (int x = 0; x < image.cols; x++, src += 3) {
+            uchar out[3];
+            lookup(src, out);
+            h.blue[out[0]]++;
+            h.green[out[1]]++;
+            h.red[out[2]]++;
+        }
+    }
+    return h;
+}
+
+// Same interpolation as lookup, at any point of the cube and without the
+// rounding
+cv::Vec3f ColorLut::operator()(const cv::Vec3f &color) const {
+    if (table.empty()) {
+        return color;
+    }
+    const int strides[3] = { 4, size_ * 4, size_ * size_ * 4 };
+    const float *c0 = &table[0];
+    float f[3];
+    for (int c = 0; c < 3; c++) {
+        float v = std::min(std::max(color[c], 0.0f), 255.0f) * (size_ - 1) /
+                  255;
+        int cell = std::min((int)v, size_ - 2);
+        f[c] = v - cell;
+        c0 += cell * strides[c];
+    }
+    // Walk from c0 to the far corner, largest fraction first
+    int order[3] = { 0, 1, 2 };
+    std::sort(order, order + 3, [&f](int a, int b) { return f[a] > f[b]; });
+    cv::Vec3f result;
+    const float *corner = c0;
+    float weight = 1 - f[order[0]];
+    for (int step = 0; step <= 3; step++) {
+        for (int c = 0; c < 3; c++) {
+            result[c] += weight * corner[c];
+        }
+        if (step < 3) {
+            corner += strides[order[step]];
+            weight = f[order[step]] - (step < 2 ? f[order[step + 1]] : 0);
+        }
+    }
+    return result;
+}
+
+bool ColorLut::save(const std::string &path) const {
+    cv::FileStorage fs(path, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) {
+        return false;
+    }
+    fs << "size" << size_;
+    fs << "table" << cv::Mat(table);
+    return true;
+}
+
+bool ColorLut::load(const std::string &path) {
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        return false;
+    }
+    int size = 0;
+    cv::Mat values;
+    fs["size"] >> size;
+    fs["table"] >> values;
+    if (size < 2 || values.type() != CV_32F ||
+        values.total() != (size_t)(size * size * size * 4)) {
+        std::cerr << "ColorLut::load: " << path << ": not a color LUT\n";
+        return false;
+    }
+    size_ = size;
+    values = values.reshape(1, 1);
+    table.assign(values.ptr<float>(), values.ptr<float>() + values.cols);
+    computeOffsets();
+    return true;
+}
+
+ColorPipeline &ColorPipeline::then(const ColorOp &op) {
+    ops.push_back(op);
+    return *this;
+}
+
+cv::Vec3f ColorPipeline::operator()(const cv::Vec3f &color) const {
+    cv::Vec3f result = color;
+    for (size_t i = 0; i < ops.size(); i++) {
+        result = ops[i](result);
+    }
+    return result;
+}
+
+ColorLut ColorPipeline::bake(int size) const {
+    return ColorLut(*this, size);
+}
+
+ColorOp gammaOp(float exponent) {
+    return [exponent](const cv::Vec3f &color) {
+        return cv::Vec3f(pow(std::max(color[0], 0.0f), exponent),
+                         pow(std::max(color[1], 0.0f), exponent),
+                         pow(std::max(color[2], 0.0f), exponent));
+    };
+}
+
+ColorOp gainOp(cv::Vec3f factor) {
+    return [factor](const cv::Vec3f &color) {
+        return color.mul(factor);
+    };
+}
+
+ColorOp whiteBalanceOp(cv::Vec3f white) {
+    float gray = (white[0] + white[1] + white[2]) / 3;
+    cv::Vec3f factor;
+    for (int c = 0; c < 3; c++) {
+        factor[c] = white[c] > 0 ? gray / white[c] : 1;
+    }
+    return gainOp(factor);
+}
+
+ColorOp saturationOp(float amount) {
+    return [amount](const cv::Vec3f &color) {
+        // Same luma weights as CV_BGR2GRAY
+        float luma = 0.114f * color[0] + 0.587f * color[1] +
+                     0.299f * color[2];
+        cv::Vec3f result;
+        for (int c = 0; c < 3; c++) {
+            result[c] = luma + amount * (color[c] - luma);
+        }
+        return result;
+    };
+}
+
+ColorOp equalizeOp(const Histogram &histogram) {
+    // Cumulative distribution per channel, scaled to 0-255
+    std::vector<cv::Vec3f> curve(256);
+    const size_t *counts[3] = {
+        histogram.blue, histogram.green, histogram.red
+    };
+    for (int c = 0; c < 3; c++) {
+        size_t total = 0;
+        for (int v = 0; v < 256; v++) {
+            total += counts[c][v];
+        }
+        size_t sum = 0;
+        for (int v = 0; v < 256; v++) {
+            sum += counts[c][v];
+            curve[v][c] = total ? (double)(sum * 255) / total : v;
+        }
+    }
+    return [curve](const cv::Vec3f &color) {
+        cv::Vec3f result;
+        for (int c = 0; c < 3; c++) {
+            float v = std::min(std::max(color[c], 0.0f), 255.0f);
+            int lo = std::min((int)v, 254);
+            float t = v - lo;
+            result[c] = (1 - t) * curve[lo][c] + t * curve[lo+1][c];
+        }
+        return result;
+    };
+}
+
+ColorLut equalizedLut(const ColorPipeline &pipeline, const cv::Mat &image,
+                      int size) {
+    Histogram histogram = pipeline.bake(size).histogram(image);
+    ColorPipeline chain = pipeline;
+    chain.then(equalizeOp(histogram));
+    return chain.bake(size);
+}
@@ -0,0 +1,112 @@
+#ifndef __CV_COLOR_LUT_H__
+#define __CV_COLOR_LUT_H__
+
+#include <opencv2/opencv.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Histogram.h"
+
+// Chains of per-pixel color operations, baked into a 3D lookup table so that
+// applying the whole chain costs one pass over the image no matter how many
+// operations are in it.
+
+// A per-pixel BGR -> BGR operation. Values are floats on the 0-255 scale of
+// an 8-bit image, but intermediate results may go outside that range (only
+// the end of a pipeline gets clamped).
+typedef std::function<cv::Vec3f(const cv::Vec3f &)> ColorOp;
+
+// A 3D color lookup table sampled on a size x size x size lattice covering
+// the 8-bit BGR cube. Lookups use tetrahedral interpolation.
+class ColorLut {
+
+  public:
+    ColorLut();
+
+    // Sample op at every lattice point (33 is the usual choice for 8-bit)
+    ColorLut(const ColorOp &op, int size=33);
+
+    // Input image MUST be BGR (8UC3)
+    cv::Mat apply(const cv::Mat &image) const;
+
+    // Same, but writes into dst (reallocated only if size/type differ)
+    void apply(const cv::Mat &image, cv::Mat &dst) const;
+
+    // Histogram of apply(image), counted without writing the result
+    Histogram histogram(const cv::Mat &image) const;
+
+    // Look up a single color (clamped to the 0-255 cube), unrounded. This
+    // makes a LUT a ColorOp, so a loaded one can go into a ColorPipeline.
+    cv::Vec3f operator()(const cv::Vec3f &color) const;
+
+    // Save or load the table (any format cv::FileStorage understands, so
+    // pick .yml, .xml or .json by file name).
+    bool save(const std::string &path) const;
+    bool load(const std::string &path);
+
+    int size() const { return size_; }
+    bool empty() const { return table.empty(); }
+
+  private:
+    int size_;
+
+    // Lattice values, 4 floats per node (B, G, R, unused) so that each node
+    // is a single aligned vector load. Indexed [r][g][b].
+    std::vector<float> table;
+
+    // Per 8-bit input value: offset of the lattice cell below it (already
+    // multiplied by the stride of each axis) and the fraction within it.
+    int offsetB[256], offsetG[256], offsetR[256];
+    float fraction[256];
+
+    void computeOffsets();
+
+    // apply() for one pixel
+    void lookup(const uchar *src, uchar *out) const;
+};
+
+// Builder for a chain of ColorOps, applied in the order they were added.
+class ColorPipeline {
+
+  public:
+    ColorPipeline &then(const ColorOp &op);
+
+    // Evaluate the whole chain for a single color (slow path; this is what
+    // gets sampled when baking).
+    cv::Vec3f operator()(const cv::Vec3f &color) const;
+
+    ColorLut bake(int size=33) const;
+
+  private:
+    std::vector<ColorOp> ops;
+};
+
+// Raise each channel to the given power (same as cv::pow on 0-255 values)
+ColorOp gammaOp(float exponent);
+
+// Multiply each channel by the matching (BGR) factor
+ColorOp gainOp(cv::Vec3f factor);
+
+// Scale channels so that 'white' (a BGR color that should have been neutral)
+// comes out gray at the same brightness.
+ColorOp whiteBalanceOp(cv::Vec3f white);
+
+// Scale distance from the pixel's luminance: 0 is grayscale, 1 is unchanged
+ColorOp saturationOp(float amount);
+
+// Per-channel histogram equalization curve computed from the histogram of
+// an image (see equal_histogram).
+ColorOp equalizeOp(const Histogram &histogram);
+
+// pipeline followed by equalizing its own output (e.g. balance, then
+// equalize). The equalization curve needs the histogram of the image after
+// pipeline, which is counted through pipeline's LUT without writing that
+// image out; then both are baked into one LUT. So the chain costs a read
+// pass plus one apply. Close to equalHistogram() of the pipeline's output,
+// but the curve is interpolated between lattice points.
+ColorLut equalizedLut(const ColorPipeline &pipeline, const cv::Mat &image,
+                      int size=33);
+
+#endif
@@ -0,0 +1,216 @@
+#include "ConvolveKernels.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "Trace.h"
+
+const float *standardGaussianTaps(int size, int sigma) {
+    if (size == 5 && sigma == 1) { return gaussianTaps5Sigma1; }
+    if (size == 11 && sigma == 2) { return gaussianTaps11Sigma2; }
+    if (size == 17 && sigma == 3) { return gaussianTaps17Sigma3; }
+    return NULL;
+}
+
+const float *standardBoxTaps(int size) {
+    if (size == 3) { return boxTaps3; }
+    if (size == 5) { return boxTaps5; }
+    return NULL;
+}
+
+Symmetry symmetryOf(const float *taps, int count) {
+    bool symmetric = true;
+    bool antisymmetric = true;
+    for (int i = 0; i <= count/2; i++) {
+        symmetric = symmetric && taps[i] == taps[count-1-i];
+        antisymmetric = antisymmetric && taps[i] == -taps[count-1-i];
+    }
+    return symmetric ? SYMMETRIC :
+           antisymmetric ? ANTISYMMETRIC : ASYMMETRIC;
+}
+
+template <int N>
+static RowCorrelator rowCorrelatorFor(const float *taps) {
+    switch (symmetryOf(taps, N)) {
+        case SYMMETRIC: return correlateRow<N, SYMMETRIC>;
+        case ANTISYMMETRIC: return correlateRow<N, ANTISYMMETRIC>;
+        default: return correlateRow<N, ASYMMETRIC>;
+    }
+}
+
+template <int N>
+static ColumnCorrelator columnCorrelatorFor(const float *taps) {
+    switch (symmetryOf(taps, N)) {
+        case SYMMETRIC: return correlateColumn<N, SYMMETRIC>;
+        case ANTISYMMETRIC: return correlateColumn<N, ANTISYMMETRIC>;
+        default: return correlateColumn<N, ASYMMETRIC>;
+    }
+}
+
+RowCorrelator rowCorrelator(const float *taps, int count) {
+    switch (count) {
+        case 3: return rowCorrelatorFor<3>(taps);
+        case 5: return rowCorrelatorFor<5>(taps);
+        case 11: return rowCorrelatorFor<11>(taps);
+        case 17: return rowCorrelatorFor<17>(taps);
+        default: return NULL;
+    }
+}
+
+ColumnCorrelator columnCorrelator(const float *taps, int count) {
+    switch (count) {
+        case 3: return columnCorrelatorFor<3>(taps);
+        case 5: return columnCorrelatorFor<5>(taps);
+        case 11: return columnCorrelatorFor<11>(taps);
+        case 17: return columnCorrelatorFor<17>(taps);
+        default: return NULL;
+    }
+}
+
+bool separateKernel(const cv::Mat &kernel, float *column, float *row) {
+    int n = kernel.rows;
+    if (kernel.type() != CV_32F || kernel.cols != n ||
+        n > MAX_SPECIALIZED_SIZE) {
+        return false;
+    }
+    cv::Point peak(0, 0);
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            if (fabs(kernel.at<float>(j, i)) >
+                fabs(kernel.at<float>(peak))) {
+                peak = cv::Point(i, j);
+            }
+        }
+    }
+    float pivot = kernel.at<float>(peak);
+    if (pivot == 0) {
+        return false;
+    }
+    for (int i = 0; i < n; i++) {
+        row[n-1-i] = kernel.at<float>(peak.y, i);
+        column[n-1-i] = kernel.at<float>(i, peak.x) / pivot;
+    }
+    float tolerance = 1e-5f * fabs(pivot);
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            float product = column[n-1-j] * row[n-1-i];
+            if (fabs(kernel.at<float>(j, i) - product) > tolerance) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Convert image to CV_32FC3 with radius pixels of replicated border all
+// round, so the specialized passes never have to clamp coordinates.
+static void padImage(const cv::Mat &image, int radius, cv::Mat &padded) {
+    padded.create(image.rows + 2*radius, image.cols + 2*radius, CV_32FC3);
+    cv::Mat center = padded(cv::Rect(radius, radius, image.cols, image.rows));
+    image.convertTo(center, CV_32F);
+    const size_t pixel = 3 * sizeof(float);
+    for (int y = radius; y < radius + image.rows; y++) {
+        float *row = padded.ptr<float>(y);
+        const float *first = row + radius * 3;
+        const float *last = row + (radius + image.cols - 1) * 3;
+        for (int b = 0; b < radius; b++) {
+            memcpy(row + b * 3, first, pixel);
+            memcpy(row + (radius + image.cols + b) * 3, last, pixel);
+        }
+    }
+    const size_t rowBytes = padded.cols * pixel;
+    for (int b = 0; b < radius; b++) {
+        memcpy(padded.ptr(b), padded.ptr(radius), rowBytes);
+        memcpy(padded.ptr(radius + image.rows + b),
+               padded.ptr(radius + image.rows - 1), rowBytes);
+    }
+}
+
+template <int N>
+static void separablePasses(const cv::Mat &padded, const float *column,
+                            const float *row, cv::Mat &rowPass,
+                            cv::Mat &result) {
+    switch (symmetryOf(row, N)) {
+        case SYMMETRIC:
+            correlateRows<N, SYMMETRIC>(padded, row, rowPass); break;
+        case ANTISYMMETRIC:
+            correlateRows<N, ANTISYMMETRIC>(padded, row, rowPass); break;
+        case ASYMMETRIC:
+            correlateRows<N, ASYMMETRIC>(padded, row, rowPass); break;
+    }
+    switch (symmetryOf(column, N)) {
+        case SYMMETRIC:
+            correlateColumns<N, SYMMETRIC>(rowPass, column, result); break;
+        case ANTISYMMETRIC:
+            correlateColumns<N, ANTISYMMETRIC>(rowPass, column, result); break;
+        case ASYMMETRIC:
+            correlateColumns<N, ASYMMETRIC>(rowPass, column, result); break;
+    }
+}
+
+template <int N>
+static void pass2D(const cv::Mat &padded, const float *taps,
+                   cv::Mat &result) {
+    switch (symmetryOf(taps, N * N)) {
+        case SYMMETRIC:
+            correlate2D<N, SYMMETRIC>(padded, taps, result); break;
+        case ANTISYMMETRIC:
+            correlate2D<N, ANTISYMMETRIC>(padded, taps, result); break;
+        case ASYMMETRIC:
+            correlate2D<N, ASYMMETRIC>(padded, taps, result); break;
+    }
+}
+
+template <int N>
+static void convolve(const cv::Mat &padded, bool separable,
+                     const float *column, const float *row,
+                     const float *taps, cv::Mat &rowPass, cv::Mat &result) {
+    if (separable) {
+        separablePasses<N>(padded, column, row, rowPass, result);
+    } else {
+        pass2D<N>(padded, taps, result);
+    }
+}
+
+bool convolveSpecialized(const cv::Mat &image, const cv::Mat &kernel,
+                         cv::Mat &result, cv::Mat &padded, cv::Mat &rowPass) {
+    int n = kernel.rows;
+    if (image.channels() != 3 || kernel.type() != CV_32F ||
+        kernel.cols != n || (n != 3 && n != 5 && n != 11 && n != 17)) {
+        return false;
+    }
+    float column[MAX_SPECIALIZED_SIZE];
+    float row[MAX_SPECIALIZED_SIZE];
+    float taps[MAX_SPECIALIZED_SIZE * MAX_SPECIALIZED_SIZE];
+    bool separable = separateKernel(kernel, column, row);
+    if (!separable) {
+        // Flipped, so the passes are plain correlations
+        for (int j = 0; j < n; j++) {
+            for (int i = 0; i < n; i++) {
+                taps[(n-1-j) * n + (n-1-i)] = kernel.at<float>(j, i);
+            }
+        }
+    }
+    {
+        TRACE_SCOPE("filter/pad");
+        padImage(image, n/2, padded);
+    }
+    TRACE_SCOPE("filter/convolve_unrolled");
+    switch (n) {
+        case 3:
+            convolve<3>(padded, separable, column, row, taps, rowPass, result);
+            break;
+        case 5:
+            convolve<5>(padded, separable, column, row, taps, rowPass, result);
+            break;
+        case 11:
+            convolve<11>(padded, separable, column, row, taps, rowPass,
+                         result);
+            break;
+        case 17:
+            convolve<17>(padded, separable, column, row, taps, rowPass,
+                         result);
+            break;
+    }
+    return true;
+}
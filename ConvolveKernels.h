@@ -0,0 +1,193 @@
+#ifndef __CV_CONVOLVE_KERNELS_H__
+#define __CV_CONVOLVE_KERNELS_H__
+
+#include <opencv2/opencv.hpp>
+
+#define MAX_SPECIALIZED_SIZE 17
+
+// Convolution routines specialized at compile time on kernel size and
+// symmetry. The taps are unrolled by the templates below, and for symmetric
+// (or antisymmetric) kernels each pair of mirrored taps shares a multiply.
+// convolveSpecialized() looks at a runtime kernel and picks the matching
+// instance; filter() falls back to its generic loop when there isn't one.
+
+// 1D factors of the standard kernels, as constexpr tables so building the
+// kernels needs no exp() calls. The Gaussian ones are
+// exp(-x^2/2σ^2) / sqrt(2πσ^2), whose outer product is gaussian(x, y, σ).
+static constexpr float gaussianTaps5Sigma1[5] = {
+    0.0539909665f, 0.241970725f, 0.39894228f, 0.241970725f, 0.0539909665f
+};
+static constexpr float gaussianTaps11Sigma2[11] = {
+    0.00876415025f, 0.0269954833f, 0.0647587978f, 0.120985362f,
+    0.176032663f, 0.19947114f, 0.176032663f, 0.120985362f, 0.0647587978f,
+    0.0269954833f, 0.00876415025f
+};
+static constexpr float gaussianTaps17Sigma3[17] = {
+    0.00379866201f, 0.0087406297f, 0.0179969888f, 0.0331590463f,
+    0.0546700249f, 0.0806569082f, 0.106482669f, 0.125794409f, 0.13298076f,
+    0.125794409f, 0.106482669f, 0.0806569082f, 0.0546700249f, 0.0331590463f,
+    0.0179969888f, 0.0087406297f, 0.00379866201f
+};
+static constexpr float boxTaps3[3] = { 1/3.0f, 1/3.0f, 1/3.0f };
+static constexpr float boxTaps5[5] = { 0.2f, 0.2f, 0.2f, 0.2f, 0.2f };
+
+// 1D taps for a standard gaussianKernel(size x size, sigma), or NULL
+const float *standardGaussianTaps(int size, int sigma);
+
+// 1D taps for a standard boxKernel(size x size), or NULL
+const float *standardBoxTaps(int size);
+
+enum Symmetry {
+    SYMMETRIC,      // k[i] == k[n-1-i]
+    ANTISYMMETRIC,  // k[i] == -k[n-1-i]
+    ASYMMETRIC
+};
+
+Symmetry symmetryOf(const float *taps, int count);
+
+// Sum of taps[m] times the source value at tap m, fully unrolled. The taps
+// are laid out as Count/W rows of W (so W == Count is a row, W == 1 a
+// column), centered on p; pixelStride and rowStride are in floats. Mirrored
+// taps are folded according to S.
+template <int Count, int W, int S, int M = 0, bool Center = (M == Count/2)>
+struct Taps {
+    static inline int offset(int m, int pixelStride, int rowStride) {
+        return (m / W - Count / W / 2) * rowStride +
+               (m % W - W / 2) * pixelStride;
+    }
+
+    static inline float sum(const float *p, const float *taps,
+                            int pixelStride, int rowStride) {
+        const float a = p[offset(M, pixelStride, rowStride)];
+        const float b = p[offset(Count - 1 - M, pixelStride, rowStride)];
+        float pair = S == SYMMETRIC ? taps[M] * (a + b) :
+                     S == ANTISYMMETRIC ? taps[M] * (a - b) :
+                     taps[M] * a + taps[Count - 1 - M] * b;
+        return pair + Taps<Count, W, S, M + 1>::sum(p, taps, pixelStride,
+                                                    rowStride);
+    }
+};
+
+// The center tap ends the recursion (it's zero in an antisymmetric kernel)
+template <int Count, int W, int S, int M>
+struct Taps<Count, W, S, M, true> {
+    static inline float sum(const float *p, const float *taps, int, int) {
+        return S == ANTISYMMETRIC ? 0 : taps[M] * p[0];
+    }
+};
+
+// Same sums as Taps<Count, 1, S> (a column), but over separate row pointers
+// (tap m reads rows[m]), for row windows that aren't laid out in order.
+template <int Count, int S, int M = 0, bool Center = (M == Count/2)>
+struct ColumnTaps {
+    static inline float sum(const float *const *rows, int x,
+                            const float *taps) {
+        const float a = rows[M][x];
+        const float b = rows[Count - 1 - M][x];
+        float pair = S == SYMMETRIC ? taps[M] * (a + b) :
+                     S == ANTISYMMETRIC ? taps[M] * (a - b) :
+                     taps[M] * a + taps[Count - 1 - M] * b;
+        return pair + ColumnTaps<Count, S, M + 1>::sum(rows, x, taps);
+    }
+};
+
+template <int Count, int S, int M>
+struct ColumnTaps<Count, S, M, true> {
+    static inline float sum(const float *const *rows, int x,
+                            const float *taps) {
+        return S == ANTISYMMETRIC ? 0 : taps[M] * rows[M][x];
+    }
+};
+
+// One row of correlateRows(): count values from src, which has N/2 pixels
+// of border before and after it
+template <int N, int S>
+void correlateRow(const float *src, const float *taps, int pixelStride,
+                  int count, float *out) {
+    for (int x = 0; x < count; x++) {
+        out[x] = Taps<N, N, S>::sum(src + x, taps, pixelStride, 0);
+    }
+}
+
+// One row of correlateColumns(), from the N rows around it
+template <int N, int S>
+void correlateColumn(const float *const *rows, const float *taps, int count,
+                     float *out) {
+    for (int x = 0; x < count; x++) {
+        out[x] = ColumnTaps<N, S>::sum(rows, x, taps);
+    }
+}
+
+typedef void (*RowCorrelator)(const float *src, const float *taps,
+                              int pixelStride, int count, float *out);
+typedef void (*ColumnCorrelator)(const float *const *rows, const float *taps,
+                                 int count, float *out);
+
+// The specialized correlateRow() and correlateColumn() for count taps (3, 5,
+// 11 or 17) with the symmetry of taps, or NULL for other sizes
+RowCorrelator rowCorrelator(const float *taps, int count);
+ColumnCorrelator columnCorrelator(const float *taps, int count);
+
+// Correlate a padded CV_32FC3 image (radius pixels of border on every side)
+// with N taps along each row; rowPass gets the padded height and the
+// unpadded width.
+template <int N, int S>
+void correlateRows(const cv::Mat &padded, const float *taps,
+                   cv::Mat &rowPass) {
+    const int radius = N / 2;
+    const int width = padded.cols - 2 * radius;
+    rowPass.create(padded.rows, width, CV_32FC3);
+    for (int y = 0; y < padded.rows; y++) {
+        correlateRow<N, S>(padded.ptr<float>(y) + radius * 3, taps, 3,
+                           width * 3, rowPass.ptr<float>(y));
+    }
+}
+
+// Correlate the output of correlateRows() with N taps down each column
+template <int N, int S>
+void correlateColumns(const cv::Mat &rowPass, const float *taps,
+                      cv::Mat &result) {
+    const int radius = N / 2;
+    const int height = rowPass.rows - 2 * radius;
+    const int rowStride = rowPass.step1();
+    result.create(height, rowPass.cols, CV_32FC3);
+    for (int y = 0; y < height; y++) {
+        const float *src = rowPass.ptr<float>(y + radius);
+        float *out = result.ptr<float>(y);
+        for (int x = 0; x < rowPass.cols * 3; x++) {
+            out[x] = Taps<N, 1, S>::sum(src + x, taps, 1, rowStride);
+        }
+    }
+}
+
+// Correlate a padded CV_32FC3 image with an N x N kernel in one pass
+template <int N, int S>
+void correlate2D(const cv::Mat &padded, const float *taps, cv::Mat &result) {
+    const int radius = N / 2;
+    const int rowStride = padded.step1();
+    result.create(padded.rows - 2 * radius, padded.cols - 2 * radius,
+                  CV_32FC3);
+    for (int y = 0; y < result.rows; y++) {
+        const float *src = padded.ptr<float>(y + radius) + radius * 3;
+        float *out = result.ptr<float>(y);
+        for (int x = 0; x < result.cols * 3; x++) {
+            out[x] = Taps<N * N, N, S>::sum(src + x, taps, 3, rowStride);
+        }
+    }
+}
+
+// Split a square kernel of up to MAX_SPECIALIZED_SIZE into column * row,
+// if it's separable (give or take float rounding). Both come out flipped,
+// ready to correlate with, and are the taps convolveSpecialized() uses.
+bool separateKernel(const cv::Mat &kernel, float *column, float *row);
+
+// Convolve a 3-channel image with kernel (CV_32F, same convention and
+// replicated border as filter()) into result, as CV_32FC3. Square kernels
+// of size 3, 5, 11 and 17 have specialized versions: separable kernels run
+// as a row and a column pass, anything else as an unrolled 2D pass. Returns
+// false, without touching result, for other kernels. padded and rowPass are
+// scratch buffers.
+bool convolveSpecialized(const cv::Mat &image, const cv::Mat &kernel,
+                         cv::Mat &result, cv::Mat &padded, cv::Mat &rowPass);
+
+#endif
@@ -9,28 +9,15 @@
 
 #include <iostream>
 
+#include "ColorLut.h"
 #include "Histogram.h"
+#include "RawImage.h"
+#include "StripStreaming.h"
 
 #define WINDOW_NAME "Histogram Equalizer"
 
-cv::Mat equalHistogram(const cv::Mat &image) {
-    cv::Mat equalized(image.size(), CV_8UC3);
-    Histogram h = Histogram(image).cumulative();
-    size_t totalRed = h.red[255];
-    size_t totalGreen = h.green[255];
-    size_t totalBlue = h.blue[255];
-    for (int x = 0; x < image.size().width; x++) {
-        for (int y = 0; y < image.size().height; y++) {
-            cv::Point p(x, y);
-            const cv::Vec3b &origValues = image.at<cv::Vec3b>(p);
-            cv::Vec3b &newValues = equalized.at<cv::Vec3b>(p);
-            newValues[0] = (double)(h.blue[origValues[0]]*255)/totalBlue+0.5;
-            newValues[1] = (double)(h.green[origValues[1]]*255)/totalGreen+0.5;
-            newValues[2] = (double)(h.red[origValues[2]]*255)/totalRed+0.5;
-        }
-    }
-    return equalized;
-}
+// Out-of-core mode: rows per band
+#define STRIP_ROWS 256
 
 cv::Mat makeDisplayImage(const cv::Mat &image, const cv::Mat &imageHist,
                          const cv::Mat &equalized,
@@ -59,14 +46,36 @@ cv::Mat makeDisplayImage(const cv::Mat &image, const cv::Mat &imageHist,
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " [image file]\n";
+    // Raw images too big for memory get equalized band by band, into
+    // another raw image, without display
+    if (argc == 4 && strcmp(argv[1], "-s") == 0) {
+        RawImage raw;
+        if (!raw.open(argv[2])) {
+            return 1;
+        }
+        return equalHistogramStrips(raw, argv[3], STRIP_ROWS) ? 0 : 1;
+    }
+    if (argc != 2 && argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " [image file] [LUT file]\n"
+                  << "       " << argv[0]
+                  << " -s [raw image] [output raw image]\n"
+                  << "The LUT file (optional) receives this image's "
+                  << "equalization curves, for use\nwith apply_lut (e.g. on "
+                  << "other shots of the same scene).\n";
         return 1;
     }
 
-    cv::Mat image = cv::imread(argv[1]);
+    RawImage raw;
+    cv::Mat image = readImage(argv[1], raw);
     if (!image.data) {
-        std::cerr << "imread: " << argv[1] << ": didn't work out\n";
+        std::cerr << "readImage: " << argv[1] << ": didn't work out\n";
+        return 1;
+    }
+
+    if (argc == 3 &&
+        !ColorPipeline().then(equalizeOp(Histogram(image))).bake()
+            .save(argv[2])) {
+        std::cerr << "Couldn't save LUT to " << argv[2] << "\n";
         return 1;
     }
 
@@ -1,74 +1,168 @@
-#include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
 #include <iostream>
+#include <limits.h>
 #include <math.h>
+#include <stdlib.h>
 
+#include "ConvolveKernels.h"
 #include "Filter.h"
+#include "Trace.h"
 
-#define WINDOW_NAME "Filtering example"
+void bgrToGray(const cv::Mat &image, cv::Mat &gray) {
+    if (image.type() != CV_8UC3) {
+        cv::cvtColor(image, gray, CV_BGR2GRAY);
+        return;
+    }
+    gray.create(image.size(), CV_8U);
+    for (int y = 0; y < image.rows; y++) {
+        const uchar *src = image.ptr<uchar>(y);
+        uchar *dst = gray.ptr<uchar>(y);
+        for (int x = 0; x < image.cols; x++, src += 3) {
+            dst[x] = grayOf(src[0], src[1], src[2]);
+        }
+    }
+}
+
+// Row pass of the separable 3x3 filter, from gray (8-bit, or 16-bit or
+// float as cvtColor leaves deeper images) into T
+template <typename In, typename T>
+static void filterRows(const cv::Mat &gray, cv::Vec3i convR, cv::Mat &rowPass) {
+    cv::Size size = gray.size();
+    rowPass.create(size, cv::DataType<T>::type);
+    for (int y = 0; y < size.height; y++) {
+        const In *src = gray.ptr<In>(y);
+        T *out = rowPass.ptr<T>(y);
+        for (int x = 0; x < size.width; x++) {
+            int left = std::max(x-1, 0);
+            int right = std::min(x+1, size.width-1);
+            out[x] = (float)src[left]  * convR[0] +
+                     (float)src[x]     * convR[1] +
+                     (float)src[right] * convR[2];
+        }
+    }
+}
+
+// Column pass of the separable 3x3 filter, widening T to float
+template <typename T>
+static void filterColumns(const cv::Mat &rowPass, cv::Vec3i convC,
+                          cv::Mat &colPass) {
+    cv::Size size = rowPass.size();
+    colPass.create(size, CV_32F);
+    for (int y = 0; y < size.height; y++) {
+        const T *above = rowPass.ptr<T>(std::max(y-1, 0));
+        const T *row = rowPass.ptr<T>(y);
+        const T *below = rowPass.ptr<T>(std::min(y+1, size.height-1));
+        float *out = colPass.ptr<float>(y);
+        for (int x = 0; x < size.width; x++) {
+            out[x] = (float)above[x] * convC[0] + (float)row[x] * convC[1] +
+                     (float)below[x] * convC[2];
+        }
+    }
+}
+
+// Float result of the 3x3 filter, copied into all three channels (like
+// converting with CV_GRAY2BGR)
+static void copyToChannels(const cv::Mat &colPass, cv::Mat &dst) {
+    dst.create(colPass.size(), CV_32FC3);
+    for (int y = 0; y < colPass.rows; y++) {
+        const float *src = colPass.ptr<float>(y);
+        float *out = dst.ptr<float>(y);
+        for (int x = 0; x < colPass.cols; x++, out += 3) {
+            out[0] = out[1] = out[2] = src[x];
+        }
+    }
+}
 
 // convC: column vector of the separated convolution kernel
 // convR: row vector of the separated convolution kernel
 cv::Mat filter(const cv::Mat &image, cv::Vec3i convC, cv::Vec3i convR) {
-    cv::Mat grayscale, padded;
-    cv::Mat result = cv::Mat::zeros(image.size(), CV_32F);
+    FilterWorkspace workspace;
+    cv::Mat result;
+    filter(image, convC, convR, result, workspace);
+    return result;
+}
+
+void filter(const cv::Mat &image, cv::Vec3i convC, cv::Vec3i convR,
+            cv::Mat &dst, FilterWorkspace &workspace) {
+    TRACE_SCOPE("filter3x3");
     // Work in grayscale, 32-bit floating point space to avoid loss of precision
-    cv::cvtColor(image, grayscale, CV_BGR2GRAY);
-    cv::copyMakeBorder(grayscale, padded, 1, 1, 1, 1, cv::BORDER_REPLICATE);
-    cv::Mat padded32F;
-    padded.convertTo(padded32F, CV_32F);
-    cv::Size size = image.size();
+    bgrToGray(image, workspace.gray);
+    cv::Mat &rowPass = workspace.rowPass;
+    cv::Mat &colPass = workspace.colPass;
 
-    // With separable kernels it seems like you apply the row vector first
-    for (int x = 0; x < size.width; x++) {
-        for (int y = 0; y < size.height; y++) {
-            int padX = x+1;
-            int padY = y+1;
-            result.at<float>(cv::Point(x, y)) = (
-              padded32F.at<float>(cv::Point(padX-1, padY)) * convR[0] +
-              padded32F.at<float>(cv::Point(padX,   padY)) * convR[1] +
-              padded32F.at<float>(cv::Point(padX+1, padY)) * convR[2]
-            );
-        }
+    // Clamping coordinates to the image is the same as padding it with
+    // BORDER_REPLICATE first, without the padded copy.
+
+    // The row pass of 8-bit input with integer taps is an integer, so in
+    // compact mode it's stored as int16 when it can't overflow.
+    const cv::Mat &gray = workspace.gray;
+    int rowRange = 255 * (abs(convR[0]) + abs(convR[1]) + abs(convR[2]));
+    bool compact = workspace.compact && gray.depth() == CV_8U &&
+                   rowRange <= SHRT_MAX;
+
+    // With separable kernels it seems like you apply the row vector first,
+    // then the column vector
+    if (compact) {
+        filterRows<uchar, short>(gray, convR, rowPass);
+        filterColumns<short>(rowPass, convC, colPass);
+        return copyToChannels(colPass, dst);
     }
-    // Then the column vector. Need to re-pad the image.
-    cv::copyMakeBorder(result, padded32F, 1, 1, 1, 1, cv::BORDER_REPLICATE);
-    for (int x = 0; x < size.width; x++) {
-        for (int y = 0; y < size.height; y++) {
-            int padX = x+1;
-            int padY = y+1;
-            result.at<float>(cv::Point(x, y)) = (
-              padded32F.at<float>(cv::Point(padX, padY-1)) * convC[0] +
-              padded32F.at<float>(cv::Point(padX, padY))   * convC[1] +
-              padded32F.at<float>(cv::Point(padX, padY+1)) * convC[2]
-            );
-        }
+    switch (gray.depth()) {
+        case CV_8U: filterRows<uchar, float>(gray, convR, rowPass); break;
+        case CV_16U: filterRows<ushort, float>(gray, convR, rowPass); break;
+        case CV_32F: filterRows<float, float>(gray, convR, rowPass); break;
+        default:
+            std::cerr << "filter: unsupported image depth " << gray.depth()
+                      << "\n";
+            dst.release();
+            return;
     }
-    cv::Mat result8U;
-    result.convertTo(result8U, CV_8U);
-    cv::Mat colorResult;
-    cv::cvtColor(result, colorResult, CV_GRAY2BGR);
-    return colorResult;
+    filterColumns<float>(rowPass, convC, colPass);
+    copyToChannels(colPass, dst);
 }
 
 cv::Mat filter(const cv::Mat &image, const cv::Mat &kernel) {
+    FilterWorkspace workspace;
+    cv::Mat result;
+    filter(image, kernel, result, workspace);
+    return result;
+}
+
+void filter(const cv::Mat &image, const cv::Mat &kernel, cv::Mat &dst,
+            FilterWorkspace &workspace) {
+    TRACE_SCOPE("filter");
     cv::Size size = image.size();
     cv::Size kSize = kernel.size();
     // Wow, OpenCV doesn't make it possible to be agnostic to type...
     if (image.channels() != 3) {
         std::cerr << "filter only supports 3-channel images right now\n";
-        return image.clone();
+        image.copyTo(dst);
+        return;
     }
     if (kernel.type() != CV_32F) {
         std::cerr << "filter only supports CV_32F kernels right now\n";
-        return image.clone();
+        image.copyTo(dst);
+        return;
     }
     if (kSize.width % 2 == 0 || kSize.height % 2 == 0) {
         std::cerr << "filter only supports kernels with odd dimensions\n";
-        return image.clone();
+        image.copyTo(dst);
+        return;
+    }
+    cv::Mat &result = workspace.floatResult;
+    // Common kernel sizes have unrolled versions, see ConvolveKernels.h
+    if (convolveSpecialized(image, kernel, result, workspace.padded,
+                            workspace.rowPass3)) {
+        result.convertTo(dst, CV_8UC3);
+        return;
     }
-    cv::Mat floatImage;
-    image.convertTo(floatImage, CV_32FC3);
-    cv::Mat result(size, CV_32FC3);
+    cv::Mat &floatImage = workspace.floatImage;
+    {
+        TRACE_SCOPE("filter/to_float");
+        image.convertTo(floatImage, CV_32FC3);
+    }
+    result.create(size, CV_32FC3);
+    TRACE_SCOPE("filter/convolve");
     for (int x = 0; x < size.width; x++) {
         for (int y = 0; y < size.height; y++) {
             for (int c = 0; c < image.channels(); c++) {
@@ -95,49 +189,75 @@ cv::Mat filter(const cv::Mat &image, const cv::Mat &kernel) {
             }
         }
     }
-    cv::Mat ucharResult;
-    result.convertTo(ucharResult, CV_8UC3);
-    return ucharResult;
+    result.convertTo(dst, CV_8UC3);
 }
 
 cv::Mat sobel(const cv::Mat &image) {
+    FilterWorkspace workspace;
+    cv::Mat result;
+    sobel(image, result, workspace);
+    return result;
+}
+
+void sobel(const cv::Mat &image, cv::Mat &dst, FilterWorkspace &workspace) {
+    TRACE_SCOPE("sobel");
     // Source: https://en.wikipedia.org/wiki/Sobel_operator
     cv::Vec3i convXC(1, 2, 1);
     cv::Vec3i convXR(1, 0, -1);
     cv::Vec3i convYC(1, 0, -1);
     cv::Vec3i convYR(1, 2, 1);
-    cv::Mat sobelX = filter(image, convXC, convXR);
-    cv::Mat sobelY = filter(image, convYC, convYR);
+    filter(image, convXC, convXR, workspace.sobelX, workspace);
+    filter(image, convYC, convYR, workspace.sobelY, workspace);
     // Technically I think there is supposed to be a 1/4 scale factor applied
     // to the sobel kernels, but no one seems to do this in practice.
-    cv::Mat sobelXFloat, sobelYFloat;
-    sobelX.convertTo(sobelXFloat, CV_32FC3);
-    sobelY.convertTo(sobelYFloat, CV_32FC3);
-    cv::Mat magnitude;
-    cv::magnitude(sobelXFloat, sobelYFloat, magnitude);
-    cv::Mat result;
-    magnitude.convertTo(result, CV_8UC3);
-    return result;
+    dst.create(image.size(), CV_8UC3);
+    for (int y = 0; y < image.rows; y++) {
+        const float *sx = workspace.sobelX.ptr<float>(y);
+        const float *sy = workspace.sobelY.ptr<float>(y);
+        uchar *out = dst.ptr<uchar>(y);
+        for (int i = 0; i < image.cols * 3; i++) {
+            out[i] = cv::saturate_cast<uchar>(sqrt(sx[i]*sx[i] + sy[i]*sy[i]));
+        }
+    }
 }
 
 float gaussian(int x, int y, int sigma) {
-    float exp = -((float)(x*x + y*y))/(2*sigma*sigma);
-    return pow(M_E, exp) / (2*M_PI*sigma*sigma);
+    float exponent = -((float)(x*x + y*y))/(2*sigma*sigma);
+    return exp(exponent) / (2*M_PI*sigma*sigma);
 }
 
-static cv::Mat identityKernel() {
+// size x size kernel that is the outer product of taps with itself
+static cv::Mat outerProduct(const float *taps, int size) {
+    cv::Mat result(size, size, CV_32F);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            result.at<float>(y, x) = taps[y] * taps[x];
+        }
+    }
+    return result;
+}
+
+cv::Mat identityKernel() {
     cv::Mat identity = cv::Mat::zeros(3, 3, CV_32F);
     identity.at<float>(cv::Point(1, 1)) = 1;
     return identity;
 }
 
-static cv::Mat boxKernel(cv::Size size) {
+cv::Mat boxKernel(cv::Size size) {
+    if (size.width == size.height && standardBoxTaps(size.width)) {
+        return outerProduct(standardBoxTaps(size.width), size.width);
+    }
     cv::Mat box = cv::Mat::ones(size, CV_32F);
     box /= size.width * size.height;
     return box;
 }
 
 cv::Mat gaussianKernel(cv::Size size, int sigma) {
+    if (size.width == size.height &&
+        standardGaussianTaps(size.width, sigma)) {
+        return outerProduct(standardGaussianTaps(size.width, sigma),
+                            size.width);
+    }
     cv::Mat result(size, CV_32F);
     if (size.width % 2 != 1 || size.height % 2 != 1) {
         // We could support even. Maybe later.
@@ -154,7 +274,7 @@ cv::Mat gaussianKernel(cv::Size size, int sigma) {
 }
 
 // First derivative of gaussian kernel, at requested theta angle (in degrees)
-static cv::Mat dogKernel(cv::Size size, float theta, int sigma=1) {
+cv::Mat dogKernel(cv::Size size, float theta, int sigma) {
     cv::Mat G1_0 = gaussianKernel(size, sigma);
     cv::Mat G1_90 = G1_0.clone();
 
@@ -175,7 +295,7 @@ static cv::Mat dogKernel(cv::Size size, float theta, int sigma=1) {
     return cos(theta)*G1_0 + sin(theta)*G1_90;
 }
 
-static cv::Mat rightShiftKernel() {
+cv::Mat rightShiftKernel() {
     cv::Mat rightShift = (cv::Mat_<float>(5, 5) <<
         0.0, 0.0, 0.0, 0.0, 0.0,
         0.0, 0.0, 0.0, 0.0, 0.0,
@@ -185,108 +305,9 @@ static cv::Mat rightShiftKernel() {
     return rightShift;
 }
 
-static cv::Mat unsharpKernel(cv::Size size, int sigma=1) {
+cv::Mat unsharpKernel(cv::Size size, int sigma) {
     cv::Mat unsharp = gaussianKernel(size, sigma);
     unsharp *= -1;
     unsharp.at<float>(cv::Point(size.width/2, size.height/2)) += 2;
     return unsharp;
 }
-
-static void usage(const std::string &program) {
-    std::cerr << "Usage:\n";
-    std::cerr << "  " << program << " -i [image path]\n";
-    std::cerr << "  " << program << " -v [video path]\n";
-}
-
-#ifdef FILTER_MAIN
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        usage(argv[0]);
-        return 1;
-    }
-
-    // Open up the source image or video
-    cv::Mat image;
-    cv::VideoCapture capture;
-    if (strcmp(argv[1], "-i") == 0) {
-        image = cv::imread(argv[2]);
-        if (!image.data) {
-            std::cerr << "imread: " << argv[2] << ": sadness\n";
-            return 1;
-        }
-    } else if (strcmp(argv[1], "-v") == 0) {
-        capture.open(argv[2]);
-        if (!capture.isOpened()) {
-            std::cerr << "VideoCapture::open failed\n";
-            return 1;
-        }
-    } else {
-        usage(argv[0]);
-        return 1;
-    }
-
-    // Main loop
-    std::cerr << "Use keys in the display window to control filtering:\n"
-              << std::endl
-              << "  b: Box filter\n"
-              << "  g: Gaussian filter 5x5 (σ=1)\n"
-              << "  2: Gaussian filter 11x11 (σ=2)\n"
-              << "  3: Gaussian filter 17x17 (σ=3)\n"
-              << "  i: Identity filter (default)\n"
-              << "  l: Looping steerable derivative-of-Gaussian\n"
-              << "  r: Right shift\n"
-              << "  s: Steerable derivative-of-Gaussian (5x5, 45 degrees)\n"
-              << "  t: Steerable derivative-of-Gaussian (5x5, 175 degrees)\n"
-              << "  u: Unsharp filter based on Gaussian\n"
-              << "  v: Unsharp filter based on Gaussian (11x11)\n"
-              << "  w: Unsharp filter based on Gaussian (17x17)\n"
-              << std::endl
-              << "Press ESC to quit.\n";
-    cv::Mat kernel = identityKernel();
-    char lastKeyPress = 0;
-    float theta = 0;
-    while (true) {
-        if (image.data) {
-            cv::imshow(WINDOW_NAME, filter(image, kernel));
-            if (lastKeyPress == 'l' || lastKeyPress == -1) {
-                theta += 5;
-                lastKeyPress = cv::waitKey(1);
-            } else {
-                lastKeyPress = cv::waitKey(0);
-            }
-        } else {
-            cv::Mat inFrame;
-            if (!capture.grab()) {
-                std::cerr << "grab failed\n";
-                break;
-            }
-            capture.retrieve(inFrame);
-            if (inFrame.empty()) {
-                std::cerr << "empty frame\n";
-                break;
-            }
-            cv::imshow(WINDOW_NAME, filter(inFrame, kernel));
-            lastKeyPress = cv::waitKey(10);
-        }
-        switch (lastKeyPress) {
-            case 'b': kernel = boxKernel(cv::Size(5, 5)); break;
-            case 'g': kernel = gaussianKernel(cv::Size(5, 5)); break;
-            case '2': kernel = gaussianKernel(cv::Size(11, 11), 2); break;
-            case '3': kernel = gaussianKernel(cv::Size(17, 17), 3); break;
-            case 'i': kernel = identityKernel(); break;
-            case -1 : // hack for looping dog kernel
-            case 'l': kernel = dogKernel(cv::Size(5, 5), theta, 2); break;
-            case 'r': kernel = rightShiftKernel(); break;
-            case 's': kernel = dogKernel(cv::Size(5, 5), 45); break;
-            case 't': kernel = dogKernel(cv::Size(5, 5), 175); break;
-            case 'u': kernel = unsharpKernel(cv::Size(5, 5)); break;
-            case 'v': kernel = unsharpKernel(cv::Size(11, 11), 2); break;
-            case 'w': kernel = unsharpKernel(cv::Size(17, 17), 3); break;
-        }
-        if (lastKeyPress == 27) {
-            break;
-        }
-    }
-    return 0;
-}
-#endif
@@ -3,22 +3,86 @@
 
 #include <opencv2/opencv.hpp>
 
+#include <algorithm>
+
 // Note to readers: These implementations are for me to gain familiarity with
 // filtering by convolution, but you probably don't want to actually use them
 // yourself (OpenCV's built-in versions of the same will be better and faster).
 
+// Scratch buffers for the filtering functions. Pass the same workspace (and
+// destination) on every call and they only get allocated on first use or
+// when the image size changes, so e.g. filtering video frames settles into
+// making no heap allocations at all.
+//
+// With compact set, integer-valued intermediates (the row pass of the
+// separable 3x3 filter) are stored as int16 rather than float, when that's
+// exact. The results don't change; there's just less memory to move.
+struct FilterWorkspace {
+    bool compact = false;
+    cv::Mat gray;
+    cv::Mat rowPass;
+    cv::Mat colPass;
+    cv::Mat floatImage;
+    cv::Mat floatResult;
+    cv::Mat padded;
+    cv::Mat rowPass3;
+    cv::Mat sobelX;
+    cv::Mat sobelY;
+};
+
+// Gray value of one 8-bit BGR pixel, with the same fixed point weights and
+// rounding as cvtColor uses for 8-bit images
+inline uchar grayOf(uchar b, uchar g, uchar r) {
+    return (b * 1868 + g * 9617 + r * 4899 + (1 << 13)) >> 14;
+}
+
+// Same as cv::cvtColor(image, gray, CV_BGR2GRAY), but reuses gray's buffer
+void bgrToGray(const cv::Mat &image, cv::Mat &gray);
+
 // Convolve with a separated 3x3 kernel
 cv::Mat filter(const cv::Mat &image, cv::Vec3i convC, cv::Vec3i convR);
+void filter(const cv::Mat &image, cv::Vec3i convC, cv::Vec3i convR,
+            cv::Mat &dst, FilterWorkspace &workspace);
 
 // Convolve with an arbitrary kernel (assumed to be matrix of float (CV_32F))
 cv::Mat filter(const cv::Mat &image, const cv::Mat &kernel);
+void filter(const cv::Mat &image, const cv::Mat &kernel, cv::Mat &dst,
+            FilterWorkspace &workspace);
 
 // Perform Sobel's edge detection on the given image
 cv::Mat sobel(const cv::Mat &image);
+void sobel(const cv::Mat &image, cv::Mat &dst, FilterWorkspace &workspace);
+
+// Scharr derivatives in x (dx) and y (dy) at x of row, given the rows above
+// and below it, with BORDER_REFLECT_101 at the left and right ends (same
+// as cv::Scharr). harris() and the Harris graph stages share this, so both
+// compute identical gradients.
+template <typename In, typename Out>
+inline void scharrAt(const In *above, const In *row, const In *below, int x,
+                     int width, Out &dx, Out &dy) {
+    int left = x > 0 ? x - 1 : std::min(1, width - 1);
+    int right = x < width - 1 ? x + 1 : std::max(width - 2, 0);
+    dx = 3 * (above[right] - above[left]) +
+         10 * (row[right] - row[left]) +
+         3 * (below[right] - below[left]);
+    dy = 3 * (below[left] - above[left]) +
+         10 * (below[x] - above[x]) +
+         3 * (below[right] - above[right]);
+}
 
 // Two-dimensional gaussian function
 float gaussian(int x, int y, int sigma=1);
 
 cv::Mat gaussianKernel(cv::Size size, int sigma=1);
 
+// A few more kernels to play with (all CV_32F)
+cv::Mat identityKernel();
+cv::Mat boxKernel(cv::Size size);
+
+// First derivative of gaussian kernel, at requested theta angle (in degrees)
+cv::Mat dogKernel(cv::Size size, float theta, int sigma=1);
+
+cv::Mat rightShiftKernel();
+cv::Mat unsharpKernel(cv::Size size, int sigma=1);
+
 #endif
@@ -0,0 +1,274 @@
+// Interactive filtering of an image or video with the kernels in Filter.h,
+// offline filtering of a whole video into another one, or out-of-core
+// filtering of a raw image too big for memory
+
+#include <opencv2/highgui/highgui.hpp>
+#include <iostream>
+
+#include "Filter.h"
+#include "RawImage.h"
+#include "Smoothing.h"
+#include "StripStreaming.h"
+#include "Trace.h"
+#include "VideoPipeline.h"
+
+#define WINDOW_NAME "Filtering example"
+
+// Non-linear filter settings (their cost doesn't depend on these)
+#define MEDIAN_RADIUS         7
+#define BILATERAL_SIGMA_SPACE 16
+#define BILATERAL_SIGMA_RANGE 20
+
+// Offline mode: frames in flight per worker (decoded, being filtered or
+// waiting to be written in order)
+#define FRAMES_PER_WORKER 2
+
+// Out-of-core mode: output rows per band
+#define STRIP_ROWS 256
+
+enum FilterMode { LINEAR, MEDIAN, BILATERAL };
+
+struct Filtering {
+    FilterMode mode;
+    cv::Mat kernel;
+    FilterWorkspace filterWorkspace;
+    SmoothingWorkspace smoothingWorkspace;
+};
+
+static void applyFilter(const cv::Mat &image, Filtering &filtering,
+                        cv::Mat &result) {
+    switch (filtering.mode) {
+        case LINEAR:
+            filter(image, filtering.kernel, result,
+                   filtering.filterWorkspace);
+            break;
+        case MEDIAN:
+            medianFilter(image, MEDIAN_RADIUS, result,
+                         filtering.smoothingWorkspace);
+            break;
+        case BILATERAL:
+            bilateralGrid(image, BILATERAL_SIGMA_SPACE, BILATERAL_SIGMA_RANGE,
+                          result, filtering.smoothingWorkspace);
+            break;
+    }
+}
+
+// Switch to the filter for a key (see the list in main); theta is the angle
+// for the looping kernel. Returns false for keys that don't pick a filter.
+static bool selectFilter(char key, float theta, Filtering &filtering) {
+    cv::Mat kernel;
+    switch (key) {
+        case 'b': kernel = boxKernel(cv::Size(5, 5)); break;
+        case 'g': kernel = gaussianKernel(cv::Size(5, 5)); break;
+        case '2': kernel = gaussianKernel(cv::Size(11, 11), 2); break;
+        case '3': kernel = gaussianKernel(cv::Size(17, 17), 3); break;
+        case 'i': kernel = identityKernel(); break;
+        case -1 : // hack for looping dog kernel
+        case 'l': kernel = dogKernel(cv::Size(5, 5), theta, 2); break;
+        case 'r': kernel = rightShiftKernel(); break;
+        case 's': kernel = dogKernel(cv::Size(5, 5), 45); break;
+        case 't': kernel = dogKernel(cv::Size(5, 5), 175); break;
+        case 'u': kernel = unsharpKernel(cv::Size(5, 5)); break;
+        case 'v': kernel = unsharpKernel(cv::Size(11, 11), 2); break;
+        case 'w': kernel = unsharpKernel(cv::Size(17, 17), 3); break;
+        case 'm': filtering.mode = MEDIAN; return true;
+        case 'e': filtering.mode = BILATERAL; return true;
+        default: return false;
+    }
+    // Picking a kernel goes back to linear filtering
+    filtering.kernel = kernel;
+    filtering.mode = LINEAR;
+    return true;
+}
+
+// Filter every frame of a video with the filter for key, on all cores, and
+// write the result to outPath
+static int filterVideo(cv::VideoCapture &capture, const std::string &outPath,
+                       char key) {
+    int workers = defaultWorkers();
+    std::vector<Filtering> filterings(workers);
+    for (int i = 0; i < workers; i++) {
+        if (!selectFilter(key, 0, filterings[i])) {
+            std::cerr << "unknown filter key '" << key << "'\n";
+            return 1;
+        }
+    }
+    double fps = capture.get(CV_CAP_PROP_FPS);
+    cv::VideoWriter writer;
+    int frames = processVideo(capture, workers, workers * FRAMES_PER_WORKER,
+        [&filterings, key](FrameJob &job, int worker) {
+            Filtering &filtering = filterings[worker];
+            if (key == 'l') {
+                // Same rotation per frame as the interactive loop
+                selectFilter(key, 5.0f * job.index, filtering);
+            }
+            applyFilter(job.frame, filtering, job.result);
+        },
+        [&writer, &outPath, fps](const FrameJob &job) {
+            // Opened on the first frame, once the frame size is known
+            if (!writer.isOpened() &&
+                !writer.open(outPath, CV_FOURCC('M', 'J', 'P', 'G'),
+                             fps > 0 ? fps : 30, job.result.size())) {
+                std::cerr << "VideoWriter::open: " << outPath << " failed\n";
+                return false;
+            }
+            writer.write(job.result);
+            return true;
+        });
+    std::cerr << "Wrote " << frames << " frames to " << outPath << " using "
+              << workers << " threads\n";
+    return writer.isOpened() ? 0 : 1;
+}
+
+// Filter a raw image band by band with the filter for key, so it never has
+// to fit in memory
+static int filterRawImage(const std::string &inPath,
+                          const std::string &outPath, char key) {
+    RawImage raw;
+    if (!raw.open(inPath)) {
+        return 1;
+    }
+    Filtering filtering;
+    if (!selectFilter(key, 0, filtering)) {
+        std::cerr << "unknown filter key '" << key << "'\n";
+        return 1;
+    }
+    bool ok = false;
+    switch (filtering.mode) {
+        case LINEAR:
+            ok = filterStrips(raw, filtering.kernel, outPath, STRIP_ROWS);
+            break;
+        case MEDIAN:
+            ok = medianStrips(raw, MEDIAN_RADIUS, outPath, STRIP_ROWS);
+            break;
+        case BILATERAL:
+            // Every output pixel depends on the whole grid
+            std::cerr << "the bilateral grid can't be run band by band\n";
+            break;
+    }
+    return ok ? 0 : 1;
+}
+
+static void usage(const std::string &program) {
+    std::cerr << "Usage:\n";
+    std::cerr << "  " << program << " -i [image path]\n";
+    std::cerr << "  " << program << " -v [video path]\n";
+    std::cerr << "  " << program << " -o [video path] [output video] [key]\n";
+    std::cerr << "  " << program << " -s [raw image] [output raw image] "
+              << "[key]\n";
+    std::cerr << "-o filters the whole video offline, with the filter for "
+              << "one of the keys listed\nin interactive mode. -s does the "
+              << "same to a raw image (see to_raw), a band\nat a time, for "
+              << "images too big for memory.\n";
+}
+
+int main(int argc, char *argv[]) {
+    // Stage timings, when built with tracing (see Trace.h)
+    TRACE_DUMP_AT_EXIT();
+    if (argc == 5 && strcmp(argv[1], "-o") == 0) {
+        cv::VideoCapture capture(argv[2]);
+        if (!capture.isOpened()) {
+            std::cerr << "VideoCapture::open failed\n";
+            return 1;
+        }
+        return filterVideo(capture, argv[3], argv[4][0]);
+    }
+    if (argc == 5 && strcmp(argv[1], "-s") == 0) {
+        return filterRawImage(argv[2], argv[3], argv[4][0]);
+    }
+    if (argc != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Open up the source image or video
+    cv::Mat image;
+    RawImage raw;
+    cv::VideoCapture capture;
+    if (strcmp(argv[1], "-i") == 0) {
+        image = readImage(argv[2], raw);
+        if (!image.data) {
+            std::cerr << "readImage: " << argv[2] << ": sadness\n";
+            return 1;
+        }
+    } else if (strcmp(argv[1], "-v") == 0) {
+        capture.open(argv[2]);
+        if (!capture.isOpened()) {
+            std::cerr << "VideoCapture::open failed\n";
+            return 1;
+        }
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Main loop
+    std::cerr << "Use keys in the display window to control filtering:\n"
+              << std::endl
+              << "  b: Box filter\n"
+              << "  g: Gaussian filter 5x5 (σ=1)\n"
+              << "  2: Gaussian filter 11x11 (σ=2)\n"
+              << "  3: Gaussian filter 17x17 (σ=3)\n"
+              << "  i: Identity filter (default)\n"
+              << "  l: Looping steerable derivative-of-Gaussian\n"
+              << "  r: Right shift\n"
+              << "  s: Steerable derivative-of-Gaussian (5x5, 45 degrees)\n"
+              << "  t: Steerable derivative-of-Gaussian (5x5, 175 degrees)\n"
+              << "  u: Unsharp filter based on Gaussian\n"
+              << "  v: Unsharp filter based on Gaussian (11x11)\n"
+              << "  w: Unsharp filter based on Gaussian (17x17)\n"
+              << "  m: Median filter (15x15)\n"
+              << "  e: Edge-preserving bilateral filter (bilateral grid)\n"
+              << std::endl
+              << "Press ESC to quit.\n";
+    // Workspaces are reused from frame to frame so video doesn't allocate
+    // per frame
+    Filtering filtering;
+    filtering.mode = LINEAR;
+    filtering.kernel = identityKernel();
+    char lastKeyPress = 0;
+    float theta = 0;
+    cv::Mat inFrame, result;
+    while (true) {
+        if (image.data) {
+            applyFilter(image, filtering, result);
+            cv::imshow(WINDOW_NAME, result);
+            if (lastKeyPress == 'l' || lastKeyPress == -1) {
+                theta += 5;
+                lastKeyPress = cv::waitKey(1);
+            } else {
+                lastKeyPress = cv::waitKey(0);
+            }
+        } else {
+            TRACE_SCOPE("frame");
+            {
+                TRACE_SCOPE("decode");
+                if (!capture.grab()) {
+                    std::cerr << "grab failed\n";
+                    break;
+                }
+                capture.retrieve(inFrame);
+            }
+            if (inFrame.empty()) {
+                std::cerr << "empty frame\n";
+                break;
+            }
+            applyFilter(inFrame, filtering, result);
+            {
+                TRACE_SCOPE("display");
+                cv::imshow(WINDOW_NAME, result);
+            }
+            // No key (-1) would mean the looping kernel; keep the current
+            // filter instead
+            char key = cv::waitKey(10);
+            if (key != -1) {
+                lastKeyPress = key;
+            }
+        }
+        selectFilter(lastKeyPress, theta, filtering);
+        if (lastKeyPress == 27) {
+            break;
+        }
+    }
+    return 0;
+}
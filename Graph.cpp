@@ -0,0 +1,401 @@
+#include "Graph.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+
+#include "Trace.h"
+
+cv::Mat BufferPool::acquire(cv::Size size, int type) {
+    for (size_t i = 0; i < available.size(); i++) {
+        if (available[i].size() == size && available[i].type() == type) {
+            cv::Mat buffer = available[i];
+            available[i] = available.back();
+            available.pop_back();
+            return buffer;
+        }
+    }
+    return cv::Mat(size, type);
+}
+
+void BufferPool::release(const cv::Mat &buffer) {
+    available.push_back(buffer);
+}
+
+Graph &Graph::then(RowStage *stage) {
+    Node node;
+    node.row.reset(stage);
+    nodes.push_back(node);
+    return *this;
+}
+
+Graph &Graph::then(FrameStage *stage) {
+    Node node;
+    node.frame.reset(stage);
+    nodes.push_back(node);
+    return *this;
+}
+
+Graph &Graph::thenFilter(const cv::Mat &kernel, int channels) {
+    int n = kernel.rows;
+    float column[MAX_SPECIALIZED_SIZE];
+    float row[MAX_SPECIALIZED_SIZE];
+    if (separateKernel(kernel, column, row) && rowCorrelator(row, n)) {
+        return then(new RowCorrelateStage(std::vector<float>(row, row + n),
+                                          channels))
+              .then(new ColumnCorrelateStage(
+                  std::vector<float>(column, column + n), channels));
+    }
+    return then(new ConvolveStage(kernel, channels));
+}
+
+bool Graph::check(const cv::Mat &image) const {
+    int channels = image.channels();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        int in = nodes[i].row ? nodes[i].row->inChannels() :
+                                nodes[i].frame->inChannels();
+        if (in != channels) {
+            std::cerr << "Graph stage " << i << " wants " << in
+                      << " channels, gets " << channels << "\n";
+            return false;
+        }
+        channels = nodes[i].row ? nodes[i].row->outChannels() :
+                                  nodes[i].frame->outChannels();
+    }
+    return true;
+}
+
+cv::Mat Graph::run(const cv::Mat &image) {
+    run(image, result);
+    return result;
+}
+
+void Graph::run(const cv::Mat &image, cv::Mat &output) {
+    TRACE_SCOPE("graph");
+    if (!check(image)) {
+        // Don't leave the previous frame's result looking like this one's
+        output.release();
+        return;
+    }
+    if (nodes.empty()) {
+        image.convertTo(output, CV_MAKETYPE(CV_32F, image.channels()));
+        return;
+    }
+
+    // Each iteration handles either one FrameStage or a run of RowStages.
+    // Everything but the final output goes through the pool.
+    cv::Mat input = image;
+    cv::Mat pooledInput;
+    size_t first = 0;
+    while (first < nodes.size()) {
+        size_t last = first + 1;
+        if (nodes[first].row) {
+            while (last < nodes.size() && nodes[last].row) {
+                last++;
+            }
+        }
+        const Node &end = nodes[last-1];
+        int outType = CV_MAKETYPE(CV_32F, end.row ? end.row->outChannels() :
+                                                    end.frame->outChannels());
+        cv::Mat out;
+        if (last == nodes.size()) {
+            output.create(image.size(), outType);
+            out = output;
+        } else {
+            out = pool.acquire(image.size(), outType);
+        }
+
+        if (nodes[first].row) {
+            stream(input, first, last, out);
+        } else if (input.depth() != CV_32F) {
+            cv::Mat floatInput = pool.acquire(input.size(),
+                CV_MAKETYPE(CV_32F, input.channels()));
+            input.convertTo(floatInput, floatInput.type());
+            nodes[first].frame->process(floatInput, out);
+            pool.release(floatInput);
+        } else {
+            nodes[first].frame->process(input, out);
+        }
+
+        if (pooledInput.data) {
+            pool.release(pooledInput);
+        }
+        pooledInput = last == nodes.size() ? cv::Mat() : out;
+        input = out;
+        first = last;
+    }
+}
+
+void Graph::stream(const cv::Mat &input, size_t first, size_t last,
+                   cv::Mat &output) {
+    int width = input.cols;
+    size_t count = last - first;
+    streamStages.resize(count);
+    windows.resize(count);
+    nextRow.assign(count, 0);
+    size_t maxWindow = 0;
+    for (size_t i = 0; i < count; i++) {
+        RowStage *stage = nodes[first + i].row.get();
+        int rows = 2 * stage->radius() + 1;
+        streamStages[i] = stage;
+        windows[i] = pool.acquire(cv::Size(width * stage->inChannels(), rows),
+                                  CV_32F);
+        maxWindow = std::max(maxWindow, (size_t)rows);
+    }
+    rowPointers.resize(maxWindow);
+    streamOutput = output;
+
+    int channels = input.channels();
+    for (int y = 0; y < input.rows; y++) {
+        float *row = windows[0].ptr<float>(y % windows[0].rows);
+        if (input.depth() == CV_32F) {
+            memcpy(row, input.ptr<float>(y), width * channels * sizeof(float));
+        } else if (input.depth() == CV_8U) {
+            const uchar *src = input.ptr<uchar>(y);
+            for (int i = 0; i < width * channels; i++) {
+                row[i] = src[i];
+            }
+        } else {
+            cv::Mat converted(1, width * channels, CV_32F, row);
+            input.row(y).reshape(1, 1).convertTo(converted, CV_32F);
+        }
+        pushRow(0, y);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        pool.release(windows[i]);
+        windows[i] = cv::Mat();
+    }
+    streamOutput = cv::Mat();
+}
+
+void Graph::pushRow(size_t stage, int y) {
+    const int height = streamOutput.rows;
+    const int radius = streamStages[stage]->radius();
+    const cv::Mat &window = windows[stage];
+    const int border = streamStages[stage]->border();
+    // Output row e needs input rows up to e+radius; once the last input row
+    // is in, everything left can be computed (rows past the edge are made
+    // up from the last 2*radius+1 rows, which are all still in the window).
+    int until = y == height - 1 ? height - 1 : y - radius;
+    for (int e = nextRow[stage]; e <= until; e++) {
+        for (int j = 0; j <= 2 * radius; j++) {
+            int src = cv::borderInterpolate(e - radius + j, height, border);
+            rowPointers[j] = window.ptr<float>(src % window.rows);
+        }
+        float *out;
+        if (stage + 1 < streamStages.size()) {
+            cv::Mat &next = windows[stage+1];
+            out = next.ptr<float>(e % next.rows);
+        } else {
+            out = streamOutput.ptr<float>(e);
+        }
+        streamStages[stage]->processRow(&rowPointers[0], out,
+                                        streamOutput.cols, e, height);
+        nextRow[stage] = e + 1;
+        if (stage + 1 < streamStages.size()) {
+            pushRow(stage + 1, e);
+        }
+    }
+}
+
+void GrayStage::processRow(const float *const *rows, float *out,
+                           int width, int, int) const {
+    const float *in = rows[0];
+    for (int x = 0; x < width; x++, in += 3) {
+        out[x] = 0.114f * in[0] + 0.587f * in[1] + 0.299f * in[2];
+    }
+}
+
+ConvolveStage::ConvolveStage(const cv::Mat &kernel, int channels)
+    : channels(channels) {
+    if (kernel.type() != CV_32F || kernel.rows % 2 == 0 ||
+        kernel.cols % 2 == 0) {
+        std::cerr << "ConvolveStage needs an odd-sized CV_32F kernel\n";
+    }
+    // Flip it once here, so processRow is a plain correlation
+    this->kernel.create(kernel.size(), CV_32F);
+    for (int j = 0; j < kernel.rows; j++) {
+        for (int i = 0; i < kernel.cols; i++) {
+            this->kernel.at<float>(j, i) =
+                kernel.at<float>(kernel.rows - j - 1, kernel.cols - i - 1);
+        }
+    }
+}
+
+void ConvolveStage::processRow(const float *const *rows, float *out,
+                               int width, int, int) const {
+    int kRadius = kernel.cols / 2;
+    for (int x = 0; x < width; x++) {
+        for (int c = 0; c < channels; c++) {
+            float value = 0;
+            for (int j = 0; j < kernel.rows; j++) {
+                const float *k = kernel.ptr<float>(j);
+                for (int i = 0; i < kernel.cols; i++) {
+                    int srcX = std::min(std::max(x + i - kRadius, 0),
+                                        width - 1);
+                    value += rows[j][srcX * channels + c] * k[i];
+                }
+            }
+            out[x * channels + c] = value;
+        }
+    }
+}
+
+RowCorrelateStage::RowCorrelateStage(const std::vector<float> &taps,
+                                     int channels)
+    : taps(taps), channels(channels),
+      correlate(rowCorrelator(&taps[0], taps.size())) {
+    if (!correlate) {
+        std::cerr << "RowCorrelateStage has no version with " << taps.size()
+                  << " taps\n";
+    }
+}
+
+void RowCorrelateStage::processRow(const float *const *rows, float *out,
+                                   int width, int, int) const {
+    // Replicate the end pixels, like filter()'s padded copy of the image
+    const int radius = taps.size() / 2;
+    const size_t pixel = channels * sizeof(float);
+    padded.resize((width + 2 * radius) * channels);
+    const float *first = rows[0];
+    const float *last = rows[0] + (width - 1) * channels;
+    for (int b = 0; b < radius; b++) {
+        memcpy(&padded[b * channels], first, pixel);
+        memcpy(&padded[(radius + width + b) * channels], last, pixel);
+    }
+    memcpy(&padded[radius * channels], rows[0], width * pixel);
+    if (correlate) {
+        correlate(&padded[radius * channels], &taps[0], channels,
+                  width * channels, out);
+    }
+}
+
+ColumnCorrelateStage::ColumnCorrelateStage(const std::vector<float> &taps,
+                                           int channels)
+    : taps(taps), channels(channels),
+      correlate(columnCorrelator(&taps[0], taps.size())) {
+    if (!correlate) {
+        std::cerr << "ColumnCorrelateStage has no version with "
+                  << taps.size() << " taps\n";
+    }
+}
+
+void ColumnCorrelateStage::processRow(const float *const *rows, float *out,
+                                      int width, int, int) const {
+    if (correlate) {
+        correlate(rows, &taps[0], width * channels, out);
+    }
+}
+
+void ByteGrayStage::processRow(const float *const *rows, float *out,
+                               int width, int, int) const {
+    const float *in = rows[0];
+    for (int x = 0; x < width; x++, in += 3) {
+        out[x] = grayOf(cv::saturate_cast<uchar>(in[0]),
+                        cv::saturate_cast<uchar>(in[1]),
+                        cv::saturate_cast<uchar>(in[2]));
+    }
+}
+
+void StructureTensorStage::processRow(const float *const *rows, float *out,
+                                      int width, int, int) const {
+    const float *above = rows[0];
+    const float *row = rows[1];
+    const float *below = rows[2];
+    for (int x = 0; x < width; x++) {
+        float Ix, Iy;
+        scharrAt(above, row, below, x, width, Ix, Iy);
+        out[3*x]     = Ix * Ix;
+        out[3*x + 1] = Ix * Iy;
+        out[3*x + 2] = Iy * Iy;
+    }
+}
+
+BoxSumStage::BoxSumStage(int windowSize, int channels)
+    : windowSize(windowSize), channels(channels) {
+}
+
+// One value of BoxSumStage, clamping x to the row
+static float boxSumAt(const float *const *rows, int x, int c, int r,
+                      int width, int channels) {
+    float sum = 0;
+    for (int i = -r; i <= r; i++) {
+        int srcX = std::min(std::max(x + i, 0), width - 1);
+        for (int j = 0; j <= 2 * r; j++) {
+            sum += rows[j][srcX * channels + c];
+        }
+    }
+    return sum;
+}
+
+void BoxSumStage::processRow(const float *const *rows, float *out,
+                             int width, int, int) const {
+    int r = windowSize / 2;
+    int left = std::min(r, width);
+    int right = std::max(width - r, left);
+    for (int x = 0; x < left; x++) {
+        for (int c = 0; c < channels; c++) {
+            out[x * channels + c] = boxSumAt(rows, x, c, r, width, channels);
+        }
+    }
+    // In between nothing needs clamping, so run over all the values in one
+    // flat loop (summing in the same order as boxSumAt)
+    for (int k = left * channels; k < right * channels; k++) {
+        float sum = 0;
+        for (int i = -r; i <= r; i++) {
+            for (int j = 0; j < windowSize; j++) {
+                sum += rows[j][k + i * channels];
+            }
+        }
+        out[k] = sum;
+    }
+    for (int x = right; x < width; x++) {
+        for (int c = 0; c < channels; c++) {
+            out[x * channels + c] = boxSumAt(rows, x, c, r, width, channels);
+        }
+    }
+}
+
+HarrisResponseStage::HarrisResponseStage(int windowSize, float threshold)
+    : windowSize(windowSize), threshold(threshold) {
+}
+
+void HarrisResponseStage::processRow(const float *const *rows, float *out,
+                                     int width, int y, int height) const {
+    const int r = windowSize / 2;
+    const float *m = rows[0];
+    for (int x = 0; x < width; x++, m += 3) {
+        bool inside = x >= r && x < width - r && y >= r && y < height - r;
+        float f = inside ? harrisScore(m[0], m[1], m[2]) : 0;
+        // Thresholded to zero (NaN from an all-flat window too)
+        out[x] = f > threshold ? f : 0;
+    }
+}
+
+LocalMaximumStage::LocalMaximumStage(float threshold) : threshold(threshold) {
+}
+
+void LocalMaximumStage::processRow(const float *const *rows, float *out,
+                                   int width, int, int) const {
+    for (int x = 0; x < width; x++) {
+        float center = rows[1][x];
+        bool isMax = center > threshold;
+        // Anything at or below the threshold is smaller than center anyway.
+        // At the image edges the replicated neighbor is center itself, so
+        // edge pixels never count as maxima (same as harris()).
+        for (int j = 0; j < 3 && isMax; j++) {
+            for (int i = -1; i <= 1; i++) {
+                if (j == 1 && i == 0) {
+                    continue;
+                }
+                int srcX = std::min(std::max(x + i, 0), width - 1);
+                if (rows[j][srcX] >= center) {
+                    isMax = false;
+                    break;
+                }
+            }
+        }
+        out[x] = isMax ? center : 0;
+    }
+}
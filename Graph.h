@@ -0,0 +1,287 @@
+#ifndef __CV_GRAPH_H__
+#define __CV_GRAPH_H__
+
+#include <opencv2/opencv.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "ConvolveKernels.h"
+#include "Filter.h"
+
+// Chains of image operations that stream rows through every stage instead of
+// making a full-frame intermediate image per stage.
+//
+// Per-pixel and stencil stages (RowStage) are fused: as soon as a stage has
+// the rows it needs, it produces an output row straight into the next
+// stage's input window. Only a few rows per stage are live at a time, so the
+// whole chain works out of cache. Stages that need the whole frame
+// (FrameStage) split the chain; the executor hands them a full image and
+// starts streaming again after them.
+//
+// All data between stages is float, with any number of channels. Rows and
+// intermediate frames come from a BufferPool that lives as long as the
+// Graph, so running the same graph over frame after frame (video) doesn't
+// allocate once the first frame has been processed.
+
+// A stage that computes one output row from a window of input rows
+class RowStage {
+
+  public:
+    virtual ~RowStage() {}
+
+    virtual int inChannels() const = 0;
+    virtual int outChannels() const = 0;
+
+    // Rows needed above and below the output row (0 for per-pixel stages)
+    virtual int radius() const { return 0; }
+
+    // How rows past the top and bottom of the image are made up, as a
+    // cv::BorderTypes value (cv::borderInterpolate() picks the row)
+    virtual int border() const { return cv::BORDER_REPLICATE; }
+
+    // Compute output row y (of height). rows[0 .. 2*radius()] point at
+    // input rows y-radius .. y+radius (see border()), each
+    // width*inChannels() floats. Writes width*outChannels() floats.
+    virtual void processRow(const float *const *rows, float *out, int width,
+                            int y, int height) const = 0;
+};
+
+// A stage that needs the whole frame at once. Input and output are float
+// (CV_32FC(n)); out is a pooled buffer, so reuse it rather than replacing it.
+class FrameStage {
+
+  public:
+    virtual ~FrameStage() {}
+
+    virtual int inChannels() const = 0;
+    virtual int outChannels() const = 0;
+
+    virtual void process(const cv::Mat &in, cv::Mat &out) const = 0;
+};
+
+// Recycles buffers between stages and between runs
+class BufferPool {
+
+  public:
+    // Returns a buffer of this size and type, recycled if possible
+    cv::Mat acquire(cv::Size size, int type);
+
+    void release(const cv::Mat &buffer);
+
+  private:
+    std::vector<cv::Mat> available;
+};
+
+class Graph {
+
+  public:
+    // Stages run in the order they are added; the graph takes ownership
+    Graph &then(RowStage *stage);
+    Graph &then(FrameStage *stage);
+
+    // Stages computing the float result of filter(image, kernel) for an
+    // image with this many channels: a RowCorrelateStage and a
+    // ColumnCorrelateStage when filter() has a separable specialized version
+    // of kernel (identical results), otherwise a ConvolveStage.
+    Graph &thenFilter(const cv::Mat &kernel, int channels);
+
+    bool empty() const { return nodes.empty(); }
+
+    // Input is 8-bit or float (a RowStage at the head reads 8-bit rows as
+    // they stream, so no float copy of the frame is made). Output is float
+    // with as many channels as the last stage produces (written into
+    // output, which is reallocated only if its size or type differ). If the
+    // input doesn't have the channels the stages expect, output comes back
+    // empty.
+    void run(const cv::Mat &image, cv::Mat &output);
+
+    // Same, but the result lives in a buffer owned by the graph and is
+    // overwritten by the next run.
+    cv::Mat run(const cv::Mat &image);
+
+  private:
+    struct Node {
+        std::shared_ptr<RowStage> row;
+        std::shared_ptr<FrameStage> frame;
+    };
+
+    bool check(const cv::Mat &image) const;
+
+    // Stream rows of input through nodes [first, last), all RowStages
+    void stream(const cv::Mat &input, size_t first, size_t last,
+                cv::Mat &output);
+
+    // Row y of the input to stage has been written to its window; compute
+    // whatever rows that makes possible and pass them on.
+    void pushRow(size_t stage, int y);
+
+    std::vector<Node> nodes;
+    BufferPool pool;
+    cv::Mat result;
+
+    // Streaming state, kept around so repeated runs don't allocate
+    std::vector<RowStage *> streamStages;
+    std::vector<cv::Mat> windows;   // ring of 2*radius+1 rows per stage
+    std::vector<int> nextRow;       // next output row per stage
+    std::vector<const float *> rowPointers;
+    cv::Mat streamOutput;
+};
+
+// Stock stages
+
+// BGR -> gray, same weights as CV_BGR2GRAY
+class GrayStage : public RowStage {
+
+  public:
+    int inChannels() const { return 3; }
+    int outChannels() const { return 1; }
+    void processRow(const float *const *rows, float *out, int width, int y,
+                    int height) const;
+};
+
+// Convolution with an odd-sized CV_32F kernel, same convention and border
+// handling (replicate) as filter(image, kernel), but without rounding the
+// result to 8 bits.
+class ConvolveStage : public RowStage {
+
+  public:
+    ConvolveStage(const cv::Mat &kernel, int channels);
+
+    int inChannels() const { return channels; }
+    int outChannels() const { return channels; }
+    int radius() const { return kernel.rows / 2; }
+    void processRow(const float *const *rows, float *out, int width, int y,
+                    int height) const;
+
+  private:
+    cv::Mat kernel;
+    int channels;
+};
+
+// Row pass of a separable convolution: taps (already flipped, as
+// separateKernel() gives them) correlated along each row with a replicated
+// border, using filter()'s specialized code. taps.size() must be one of the
+// sizes rowCorrelator() handles.
+class RowCorrelateStage : public RowStage {
+
+  public:
+    RowCorrelateStage(const std::vector<float> &taps, int channels);
+
+    int inChannels() const { return channels; }
+    int outChannels() const { return channels; }
+    void processRow(const float *const *rows, float *out, int width, int y,
+                    int height) const;
+
+  private:
+    std::vector<float> taps;
+    int channels;
+    RowCorrelator correlate;
+    mutable std::vector<float> padded;
+};
+
+// Column pass to go with RowCorrelateStage
+class ColumnCorrelateStage : public RowStage {
+
+  public:
+    ColumnCorrelateStage(const std::vector<float> &taps, int channels);
+
+    int inChannels() const { return channels; }
+    int outChannels() const { return channels; }
+    int radius() const { return taps.size() / 2; }
+    void processRow(const float *const *rows, float *out, int width, int y,
+                    int height) const;
+
+  private:
+    std::vector<float> taps;
+    int channels;
+    ColumnCorrelator correlate;
+};
+
+// BGR -> gray, rounding to 8 bits first like converting to CV_8UC3 and then
+// calling bgrToGray(). After thenFilter() this is exactly filter() followed
+// by bgrToGray(), as harris() starts.
+class ByteGrayStage : public RowStage {
+
+  public:
+    int inChannels() const { return 3; }
+    int outChannels() const { return 1; }
+    void processRow(const float *const *rows, float *out, int width, int y,
+                    int height) const;
+};
+
+// Gray -> Harris structure tensor terms (Ix*Ix, Ix*Iy, Iy*Iy), from the same
+// Scharr derivatives as harris() (scharrAt(), reflect-101 borders all round)
+class StructureTensorStage : public RowStage {
+
+  public:
+    int inChannels() const { return 1; }
+    int outChannels() const { return 3; }
+    int radius() const { return 1; }
+    int border() const { return cv::BORDER_REFLECT_101; }
+    void processRow(const float *const *rows, float *out, int width, int y,
+                    int height) const;
+};
+
+// Sum over a windowSize x windowSize box (windowSize odd), column by column
+// in the same order as harris() sums its window
+class BoxSumStage : public RowStage {
+
+  public:
+    BoxSumStage(int windowSize, int channels);
+
+    int inChannels() const { return channels; }
+    int outChannels() const { return channels; }
+    int radius() const { return windowSize / 2; }
+    void processRow(const float *const *rows, float *out, int width, int y,
+                    int height) const;
+
+  private:
+    int windowSize;
+    int channels;
+};
+
+// det(M) / trace(M) of a windowed structure tensor, in double like
+// cv::determinant and cv::trace. NaN for a flat window. Shared with harris().
+inline float harrisScore(float m00, float m01, float m11) {
+    double det = (double)m00 * m11 - (double)m01 * m01;
+    double trace = (double)m00 + m11;
+    return det / trace;
+}
+
+// Windowed structure tensor -> Harris response, zeroed where it isn't above
+// threshold and within windowSize/2 of the edges (where the window doesn't
+// fit), same as harris()
+class HarrisResponseStage : public RowStage {
+
+  public:
+    HarrisResponseStage(int windowSize, float threshold);
+
+    int inChannels() const { return 3; }
+    int outChannels() const { return 1; }
+    void processRow(const float *const *rows, float *out, int width, int y,
+                    int height) const;
+
+  private:
+    int windowSize;
+    float threshold;
+};
+
+// Keep values above threshold that are strictly greater than all 8
+// neighbors (after thresholding), zero everything else.
+class LocalMaximumStage : public RowStage {
+
+  public:
+    LocalMaximumStage(float threshold);
+
+    int inChannels() const { return 1; }
+    int outChannels() const { return 1; }
+    int radius() const { return 1; }
+    void processRow(const float *const *rows, float *out, int width, int y,
+                    int height) const;
+
+  private:
+    float threshold;
+};
+
+#endif
@@ -4,26 +4,29 @@ Histogram::Histogram() : blue {0}, green {0}, red {0} {
 }
 
 Histogram::Histogram(const cv::Mat &image) : blue {0}, green {0}, red {0} {
-    cv::Size size = image.size();
-    for (int x = 0; x < size.width; x++) {
-        for (int y = 0; y < size.height; y++) {
-            const cv::Vec3b &values = image.at<cv::Vec3b>(cv::Point(x, y));
-            blue[values.val[0]]++;
-            green[values.val[1]]++;
-            red[values.val[2]]++;
-        }
-    }
+    add(image);
 }
 
 Histogram::~Histogram() {
 }
 
+void Histogram::add(const cv::Mat &image) {
+    for (int y = 0; y < image.rows; y++) {
+        const cv::Vec3b *values = image.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < image.cols; x++) {
+            blue[values[x].val[0]]++;
+            green[values[x].val[1]]++;
+            red[values[x].val[2]]++;
+        }
+    }
+}
+
 Histogram Histogram::cumulative() const {
     Histogram hOut;
     hOut.blue[0] = blue[0];
     hOut.green[0] = green[0];
     hOut.red[0] = red[0];
-    for (size_t i = 0; i < 256; i++) {
+    for (size_t i = 1; i < 256; i++) {
         hOut.blue[i] = hOut.blue[i-1] + blue[i];
         hOut.green[i] = hOut.green[i-1] + green[i];
         hOut.red[i] = hOut.red[i-1] + red[i];
@@ -74,3 +77,35 @@ cv::Mat Histogram::draw() const {
     }
     return output;
 }
+
+cv::Mat equalHistogram(const cv::Mat &image) {
+    cv::Mat equalized;
+    equalHistogram(image, Histogram(image).cumulative(), equalized);
+    return equalized;
+}
+
+void equalHistogram(const cv::Mat &image, const Histogram &cumulative,
+                    cv::Mat &dst) {
+    const Histogram &h = cumulative;
+    size_t totalRed = h.red[255];
+    size_t totalGreen = h.green[255];
+    size_t totalBlue = h.blue[255];
+    // Every pixel with the same value maps the same way, so work out the
+    // mapping once per value
+    cv::Vec3b table[256];
+    for (int i = 0; i < 256; i++) {
+        table[i][0] = (double)(h.blue[i]*255)/totalBlue+0.5;
+        table[i][1] = (double)(h.green[i]*255)/totalGreen+0.5;
+        table[i][2] = (double)(h.red[i]*255)/totalRed+0.5;
+    }
+    dst.create(image.size(), CV_8UC3);
+    for (int y = 0; y < image.rows; y++) {
+        const cv::Vec3b *origValues = image.ptr<cv::Vec3b>(y);
+        cv::Vec3b *newValues = dst.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < image.cols; x++) {
+            newValues[x][0] = table[origValues[x][0]][0];
+            newValues[x][1] = table[origValues[x][1]][1];
+            newValues[x][2] = table[origValues[x][2]][2];
+        }
+    }
+}
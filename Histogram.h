@@ -1,5 +1,8 @@
 // Utilities for computing, manipulating, and drawing histograms.
 
+#ifndef __CV_HISTOGRAM_H__
+#define __CV_HISTOGRAM_H__
+
 #include <opencv2/opencv.hpp>
 
 // For now, assumes BGR, 8 bit unsigned channels
@@ -12,6 +15,9 @@ class Histogram {
     Histogram(const cv::Mat &image);
     ~Histogram();
 
+    // Count the pixels of more of the image (e.g. the next band of rows)
+    void add(const cv::Mat &image);
+
     // Integrate this histogram and return a new, cumulative histogram.
     Histogram cumulative() const;
 
@@ -23,3 +29,14 @@ class Histogram {
     size_t green[256];
     size_t red[256];
 };
+
+// Equalize each channel of a BGR (8UC3) image through its cumulative
+// histogram.
+cv::Mat equalHistogram(const cv::Mat &image);
+
+// Equalize part of an image (e.g. a band of rows) with the cumulative
+// histogram of the whole image, so big images can be done band by band.
+void equalHistogram(const cv::Mat &image, const Histogram &cumulative,
+                    cv::Mat &dst);
+
+#endif
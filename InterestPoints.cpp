@@ -1,8 +1,9 @@
 #include <opencv2/opencv.hpp>
 #include <limits>
+#include <string.h>
 #include "Filter.h"
-
-#define WINDOW_NAME "Interest point detector"
+#include "InterestPoints.h"
+#include "Trace.h"
 
 // I made these up
 #define MORAVEC_WINDOW_SIZE 15
@@ -11,7 +12,10 @@
 #define HARRIS_WINDOW_SIZE 3
 #define HARRIS_THRESHOLD 50000
 
-typedef std::list<cv::Point> PointList;
+// Denoising settings, see InterestWorkspace
+#define DENOISE_MEDIAN_RADIUS 2
+#define DENOISE_SIGMA_SPACE   8
+#define DENOISE_SIGMA_RANGE   20
 
 // Compute Sum of Squared Differences of two regions (must be same size).
 // Currently expects single channel 32-bit float.
@@ -36,34 +40,108 @@ float ssd(const cv::Mat &r1, const cv::Mat &r2) {
     return result;
 }
 
-static cv::Rect rectAtPoint(cv::Point p, int windowSize) {
-    return cv::Rect(p.x-windowSize/2, p.y-windowSize/2,
-                    windowSize, windowSize);
+// Same as ssd() on the windowSize x windowSize patches of input centered on
+// a and b, without making a header for each patch. Input is float or (in
+// compact mode) 8-bit, widened to float here.
+template <typename T>
+static float windowSsd(const cv::Mat &input, cv::Point a, cv::Point b,
+                       int windowSize) {
+    int half = windowSize/2;
+    float result = 0;
+    for (int x = 0; x < windowSize; x++) {
+        for (int y = 0; y < windowSize; y++) {
+            float diff = (float)input.at<T>(a.y - half + y, a.x - half + x) -
+                         (float)input.at<T>(b.y - half + y, b.x - half + x);
+            result += diff*diff;
+        }
+    }
+    return result;
 }
 
-// Return 8 connected points (neighbors of) p
-static PointList getNeighbors(cv::Point p) {
-    int neighborOffsets[][2] = {
-        {-1, -1}, {0, -1}, {1, -1},
-        {-1,  0},          {1,  0},
-        {-1,  1}, {0,  1}, {1,  1}
-    };
-    PointList result;
-    for (int n = 0; n < 8; n++) {
-        result.push_back(cv::Point(p.x+neighborOffsets[n][0],
-                                   p.y+neighborOffsets[n][1]));
+// 8 connected neighbors of a point, as offsets
+static const int neighborOffsets[][2] = {
+    {-1, -1}, {0, -1}, {1, -1},
+    {-1,  0},          {1,  0},
+    {-1,  1}, {0,  1}, {1,  1}
+};
+
+// Denoise (if asked to), blur and convert to gray, the first step of both
+// detectors. The gray image is float, or stays 8-bit in compact mode.
+static const cv::Mat &prepareInput(const cv::Mat &image,
+                                   InterestWorkspace &workspace) {
+    const cv::Mat *source = &image;
+    if (workspace.denoise == DENOISE_MEDIAN) {
+        medianFilter(image, DENOISE_MEDIAN_RADIUS, workspace.denoised,
+                     workspace.smoothing);
+        source = &workspace.denoised;
+    } else if (workspace.denoise == DENOISE_BILATERAL) {
+        bilateralGrid(image, DENOISE_SIGMA_SPACE, DENOISE_SIGMA_RANGE,
+                      workspace.denoised, workspace.smoothing);
+        source = &workspace.denoised;
+    }
+    if (workspace.blurKernel.empty()) {
+        workspace.blurKernel = gaussianKernel(cv::Size(5, 5));
+    }
+    filter(*source, workspace.blurKernel, workspace.blurred,
+           workspace.filter);
+    bgrToGray(workspace.blurred, workspace.gray);
+    if (workspace.compact) {
+        return workspace.gray;
+    }
+    workspace.gray.convertTo(workspace.input, CV_32F);
+    return workspace.input;
+}
+
+// Zero a matrix in place (setTo may allocate a scratch buffer)
+static void zero(cv::Mat &m) {
+    for (int y = 0; y < m.rows; y++) {
+        memset(m.ptr(y), 0, m.cols * m.elemSize());
+    }
+}
+
+// Moravec corner strength (minimum SSD to the 8 neighboring windows) at
+// every point between min and max
+template <typename T>
+static void moravecStrength(const cv::Mat &input, cv::Mat &cornerStrength,
+                            cv::Point min, cv::Point max, int windowSize) {
+    for (int x = min.x; x <= max.x; x++) {
+        for (int y = min.y; y <= max.y; y++) {
+            cv::Point p1(x, y);
+            float minssd = std::numeric_limits<float>::infinity();
+            for (int n = 0; n < 8; n++) {
+                cv::Point p2(x + neighborOffsets[n][0],
+                             y + neighborOffsets[n][1]);
+                if (p2.x < min.x || p2.x > max.x ||
+                    p2.y < min.y || p2.y > max.y) {
+                    continue;
+                }
+                float diff = windowSsd<T>(input, p1, p2, windowSize);
+                if (diff < minssd) {
+                    minssd = diff;
+                }
+            }
+            cornerStrength.at<float>(p1) = minssd;
+        }
     }
-    return result;
 }
 
 // Moravec corner detection: my cheesy version
-static PointList moravec(const cv::Mat &image) {
+PointList moravec(const cv::Mat &image) {
+    InterestWorkspace workspace;
+    PointVector points;
+    moravec(image, points, workspace);
+    return PointList(points.begin(), points.end());
+}
+
+void moravec(const cv::Mat &image, PointVector &points,
+             InterestWorkspace &workspace) {
+    TRACE_SCOPE("moravec");
     const int windowSize = MORAVEC_WINDOW_SIZE;
-    cv::Mat grayscale;
     cv::Mat input; // We'll actually work with this one
-    cv::cvtColor(filter(image, gaussianKernel(cv::Size(5, 5))),
-                 grayscale, CV_BGR2GRAY);
-    grayscale.convertTo(input, CV_32F);
+    {
+        TRACE_SCOPE("moravec/gray");
+        input = prepareInput(image, workspace);
+    }
     cv::Size size = input.size();
 
     // Define boundaries for points under consideration (must fit in window
@@ -74,206 +152,219 @@ static PointList moravec(const cv::Mat &image) {
     int maxY = size.height - windowSize/2 - 1;
 
     // First: Compute corner strength at every pixel in the image
-    cv::Mat cornerStrength = cv::Mat::zeros(size, CV_32F);
-    for (int x = minX; x <= maxX; x++) {
-        for (int y = minY; y <= maxY; y++) {
-            cv::Rect r1 = rectAtPoint(cv::Point(x, y), windowSize);
-            float minssd = std::numeric_limits<float>::infinity();
-            PointList neighbors = getNeighbors(cv::Point(x, y));
-            PointList::const_iterator p;
-            for (p = neighbors.begin(); p != neighbors.end(); ++p) {
-                if (p->x < minX || p->x > maxX ||
-                    p->y < minY || p->y > maxY) {
-                    continue;
-                }
-                cv::Rect r2 = rectAtPoint(*p, windowSize);
-                float diff = ssd(input(r1), input(r2));
-                if (diff < minssd) {
-                    minssd = diff;
-                }
-            }
-            cornerStrength.at<float>(cv::Point(x, y)) = minssd;
+    cv::Mat &cornerStrength = workspace.response;
+    cornerStrength.create(size, CV_32F);
+    zero(cornerStrength);
+    {
+        TRACE_SCOPE("moravec/strength");
+        if (input.depth() == CV_8U) {
+            moravecStrength<uchar>(input, cornerStrength, cv::Point(minX, minY),
+                                   cv::Point(maxX, maxY), windowSize);
+        } else {
+            moravecStrength<float>(input, cornerStrength, cv::Point(minX, minY),
+                                   cv::Point(maxX, maxY), windowSize);
         }
     }
         
     // Second: Scan corner strength map for local maxima.
-    PointList result;
-    for (int x = minX; x <= maxX; x++) {
-        for (int y = minY; y <= maxY; y++) {
-            cv::Point p1(x, y);
-            bool isMax = true;
-            float s1 = cornerStrength.at<float>(p1);
-            if (s1 < MORAVEC_THRESHOLD) {
-                continue;
-            }
-            PointList neighbors = getNeighbors(p1);
-            PointList::const_iterator p2;
-            for (p2 = neighbors.begin(); p2 != neighbors.end(); ++p2) {
-                float s2 = cornerStrength.at<float>(*p2);
-                if (s1 < s2) {
-                    isMax = false;
-                    break;
+    points.clear();
+    {
+        TRACE_SCOPE("moravec/nms");
+        for (int x = minX; x <= maxX; x++) {
+            for (int y = minY; y <= maxY; y++) {
+                cv::Point p1(x, y);
+                bool isMax = true;
+                float s1 = cornerStrength.at<float>(p1);
+                if (s1 < MORAVEC_THRESHOLD) {
+                    continue;
+                }
+                for (int n = 0; n < 8; n++) {
+                    float s2 = cornerStrength.at<float>(
+                        y + neighborOffsets[n][1], x + neighborOffsets[n][0]);
+                    if (s1 < s2) {
+                        isMax = false;
+                        break;
+                    }
+                }
+                if (isMax) {
+                    points.push_back(p1);
                 }
-            }
-            if (isMax) {
-                result.push_back(p1);
             }
         }
     }
-    
-    return result;
+    TRACE_COUNTER("moravec/points", points.size());
 }
 
-static cv::Mat computeHarrisMatrix(const cv::Mat &dx, const cv::Mat &dy,
-                                   int x, int y) {
+// Scharr derivative in x (dx) and y (dy) with BORDER_REFLECT_101, same
+// result as cv::Scharr on a float image. In compact mode In is 8-bit and
+// Out is int16, which holds the result exactly (|d| <= 16 * 255).
+template <typename In, typename Out>
+static void scharr(const cv::Mat &input, cv::Mat &dx, cv::Mat &dy) {
+    cv::Size size = input.size();
+    dx.create(size, cv::DataType<Out>::type);
+    dy.create(size, cv::DataType<Out>::type);
+    for (int y = 0; y < size.height; y++) {
+        int yUp = y > 0 ? y - 1 : std::min(1, size.height - 1);
+        int yDown = y < size.height - 1 ? y + 1 : std::max(size.height - 2, 0);
+        const In *above = input.ptr<In>(yUp);
+        const In *row = input.ptr<In>(y);
+        const In *below = input.ptr<In>(yDown);
+        Out *outX = dx.ptr<Out>(y);
+        Out *outY = dy.ptr<Out>(y);
+        for (int x = 0; x < size.width; x++) {
+            scharrAt(above, row, below, x, size.width, outX[x], outY[x]);
+        }
+    }
+}
+
+// Thresholded Harris response det(M) / trace(M) for every pixel whose
+// window fits in the image (harrisMat must be zeroed). The derivatives are
+// float, or int16 in compact mode.
+template <typename D>
+static void harrisResponse(const cv::Mat &dx, const cv::Mat &dy,
+                           cv::Mat &harrisMat) {
+    cv::Size size = dx.size();
     int winSize = HARRIS_WINDOW_SIZE;
-    cv::Mat m = cv::Mat::zeros(cv::Size(2, 2), CV_32F);
-    for (int i = 0; i < winSize; i++) {
-        for (int j = 0; j < winSize; j++) {
-            cv::Point p(x + i - winSize/2, y + j - winSize/2);
-            float Ix = dx.at<float>(p);
-            float Iy = dy.at<float>(p);
-            m.at<float>(0, 0) += Ix * Ix;
-            m.at<float>(0, 1) += Ix * Iy;
-            m.at<float>(1, 0) += Ix * Iy;
-            m.at<float>(1, 1) += Iy * Iy;
+    for (int x = winSize/2; x < size.width - winSize/2; x++) {
+        for (int y = winSize/2; y < size.height - winSize/2; y++) {
+            // Harris matrix summed over the window, then det / trace
+            float m00 = 0, m01 = 0, m11 = 0;
+            for (int i = 0; i < winSize; i++) {
+                for (int j = 0; j < winSize; j++) {
+                    cv::Point p(x + i - winSize/2, y + j - winSize/2);
+                    float Ix = dx.at<D>(p);
+                    float Iy = dy.at<D>(p);
+                    m00 += Ix * Ix;
+                    m01 += Ix * Iy;
+                    m11 += Iy * Iy;
+                }
+            }
+            float f = harrisScore(m00, m01, m11);
+            // Thresholded to zero (NaN from an all-flat window too)
+            harrisMat.at<float>(y, x) = f > HARRIS_THRESHOLD ? f : 0;
         }
     }
-    return m;
 }
 
-static PointList harris(const cv::Mat &image) {
-    PointList result;
-    cv::Mat grayscale;
+PointList harris(const cv::Mat &image) {
+    InterestWorkspace workspace;
+    PointVector points;
+    harris(image, points, workspace);
+    return PointList(points.begin(), points.end());
+}
+
+void harris(const cv::Mat &image, PointVector &points,
+            InterestWorkspace &workspace) {
+    TRACE_SCOPE("harris");
     cv::Mat input; // We'll actually work with this one
-    cv::cvtColor(filter(image, gaussianKernel(cv::Size(5, 5))),
-                 grayscale, CV_BGR2GRAY);
-    grayscale.convertTo(input, CV_32F);
+    {
+        TRACE_SCOPE("harris/gray");
+        input = prepareInput(image, workspace);
+    }
     cv::Size size = input.size();
     int winSize = HARRIS_WINDOW_SIZE;
 
     // Compute first derivative in x- and y-direction
-    cv::Mat dx, dy;
-    cv::Scharr(input, dx, -1, 1, 0);
-    cv::Scharr(input, dy, -1, 0, 1);
+    cv::Mat &dx = workspace.dx;
+    cv::Mat &dy = workspace.dy;
+    {
+        TRACE_SCOPE("harris/gradients");
+        if (input.depth() == CV_8U) {
+            scharr<uchar, short>(input, dx, dy);
+        } else {
+            scharr<float, float>(input, dx, dy);
+        }
+    }
     // harris operator applied to input
-    cv::Mat harrisMat = cv::Mat::zeros(size, CV_32F);
+    cv::Mat &harrisMat = workspace.response;
+    harrisMat.create(size, CV_32F);
+    zero(harrisMat);
 
-    for (int x = winSize/2; x < size.width - winSize/2; x++) {
-        for (int y = winSize/2; y < size.height - winSize/2; y++) {
-            cv::Mat m = computeHarrisMatrix(dx, dy, x, y);
-            float f = cv::determinant(m) / cv::trace(m)[0];
-            harrisMat.at<float>(cv::Point(x, y)) = f;
+    {
+        TRACE_SCOPE("harris/response");
+        if (dx.depth() == CV_16S) {
+            harrisResponse<short>(dx, dy, harrisMat);
+        } else {
+            harrisResponse<float>(dx, dy, harrisMat);
         }
     }
 
-    cv::threshold(harrisMat, harrisMat, HARRIS_THRESHOLD, -1,
-                  cv::THRESH_TOZERO);
-
-    // Find local maxima
-    for (int x = winSize/2; x < size.width - winSize/2; x++) {
-        for (int y = winSize/2; y < size.height - winSize/2; y++) {
-            cv::Point p(x, y);
-            bool localMaximum = true;
-            PointList neighbors = getNeighbors(p);
-            PointList::const_iterator n;
-            for (n = neighbors.begin(); n != neighbors.end(); ++n) {
-                if (harrisMat.at<float>(p) <= harrisMat.at<float>(*n)) {
-                    localMaximum = false;
-                    break;
+    points.clear();
+    {
+        TRACE_SCOPE("harris/nms");
+        // Find local maxima
+        for (int x = winSize/2; x < size.width - winSize/2; x++) {
+            for (int y = winSize/2; y < size.height - winSize/2; y++) {
+                bool localMaximum = true;
+                float center = harrisMat.at<float>(y, x);
+                for (int n = 0; n < 8; n++) {
+                    if (center <= harrisMat.at<float>(
+                            y + neighborOffsets[n][1],
+                            x + neighborOffsets[n][0])) {
+                        localMaximum = false;
+                        break;
+                    }
+                }
+                if (localMaximum) {
+                    points.push_back(cv::Point(x, y));
                 }
             }
-            if (localMaximum) {
-                result.push_back(p);
+        }
+    }
+    TRACE_COUNTER("harris/points", points.size());
+}
+
+void buildHarrisGraph(Graph &graph) {
+    // Same steps as prepareInput() and harris(), blur and rounding to 8 bits
+    // included, but streaming rows from the 8-bit input to the maxima
+    graph.thenFilter(gaussianKernel(cv::Size(5, 5)), 3)
+         .then(new ByteGrayStage)
+         .then(new StructureTensorStage)
+         .then(new BoxSumStage(HARRIS_WINDOW_SIZE, 3))
+         .then(new HarrisResponseStage(HARRIS_WINDOW_SIZE, HARRIS_THRESHOLD))
+         .then(new LocalMaximumStage(HARRIS_THRESHOLD));
+}
+
+PointList harris(const cv::Mat &image, Graph &graph) {
+    TRACE_SCOPE("harris_graph");
+    if (graph.empty()) {
+        buildHarrisGraph(graph);
+    }
+    // Empty (no points) if the graph couldn't run on image
+    cv::Mat maxima = graph.run(image);
+    PointList result;
+    for (int y = 0; y < maxima.rows; y++) {
+        const float *row = maxima.ptr<float>(y);
+        for (int x = 0; x < maxima.cols; x++) {
+            if (row[x] > 0) {
+                result.push_back(cv::Point(x, y));
             }
         }
     }
+    TRACE_COUNTER("harris/points", result.size());
     return result;
 }
 
-static cv::Mat renderInterestPoints(const PointList &points,
-                                    const cv::Mat &image, cv::Scalar color) {
+static void drawCross(cv::Mat &image, const cv::Point &p, cv::Scalar color) {
+    cv::line(image, cv::Point(p.x, p.y-2), cv::Point(p.x, p.y+2), color);
+    cv::line(image, cv::Point(p.x-2, p.y), cv::Point(p.x+2, p.y), color);
+}
+
+cv::Mat renderInterestPoints(const PointList &points, const cv::Mat &image,
+                             cv::Scalar color) {
+    TRACE_SCOPE("render");
     cv::Mat result;
     image.copyTo(result);
     for (PointList::const_iterator p = points.begin(); p != points.end(); ++p) {
-        cv::line(result, cv::Point(p->x, p->y-2), cv::Point(p->x, p->y+2),
-                 color);
-        cv::line(result, cv::Point(p->x-2, p->y), cv::Point(p->x+2, p->y),
-                 color);
+        drawCross(result, *p, color);
     }
     return result;
 }
 
-static void usage(const std::string &program) {
-    std::cerr << "Usage:\n"
-              << "  " << program << " -i [image path]\n"
-              << "  " << program << " -v [video path]\n";
-}
-
-#ifdef INTEREST_MAIN
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        usage(argv[0]);
-        return 1;
+void renderInterestPoints(const PointVector &points, cv::Mat &image,
+                          cv::Scalar color) {
+    TRACE_SCOPE("render");
+    for (size_t i = 0; i < points.size(); i++) {
+        drawCross(image, points[i], color);
     }
-
-    // Open up the source image or video
-    cv::Mat image;
-    cv::VideoCapture capture;
-    if (strcmp(argv[1], "-i") == 0) {
-        image = cv::imread(argv[2]);
-        if (!image.data) {
-            std::cerr << "imread: " << argv[2] << ": nada\n";
-            return 1;
-        }
-    } else if (strcmp(argv[1], "-v") == 0) {
-        capture.open(argv[2]);
-        if (!capture.isOpened()) {
-            std::cerr << "VideoCapture::open failed\n";
-            return 1;
-        }
-    } else {
-        usage(argv[0]);
-        return 1;
-    }
-
-    // Main loop
-    std::cerr << "Press ESC in the image window to quit.\n";
-    while (true) {
-        char lastKeyPress = -1;
-        if (image.data) {
-            cv::Mat result = image.clone();
-            std::cerr << "Computing Harris interest points... ";
-            result = renderInterestPoints(harris(image), result,
-                                          cv::Scalar(0, 0, 255));
-            std::cerr << "Done.\n";
-            std::cerr << "Computing Moravec interest points... ";
-            result = renderInterestPoints(moravec(image), result,
-                                          cv::Scalar(0, 255, 0));
-            std::cerr << "Done.\n";
-            cv::imshow(WINDOW_NAME, result);
-            lastKeyPress = cv::waitKey(0);
-        } else {
-            cv::Mat inFrame;
-            if (!capture.grab()) {
-                std::cerr << "grab failed\n";
-                break;
-            }
-            capture.retrieve(inFrame);
-            if (inFrame.empty()) {
-                std::cerr << "empty frame\n";
-                break;
-            }
-            cv::Mat result = renderInterestPoints(harris(inFrame), inFrame,
-                                                  cv::Scalar(0, 0, 255));
-            cv::imshow(WINDOW_NAME, result);
-            lastKeyPress = cv::waitKey(1);
-        }
-        if (lastKeyPress == 27) {
-            break;
-        }
-    }
-
-    return 0;
 }
-#endif
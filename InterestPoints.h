@@ -0,0 +1,77 @@
+#ifndef __CV_INTEREST_POINTS_H__
+#define __CV_INTEREST_POINTS_H__
+
+#include <opencv2/opencv.hpp>
+
+#include <list>
+#include <vector>
+
+#include "Filter.h"
+#include "Graph.h"
+#include "Smoothing.h"
+
+typedef std::list<cv::Point> PointList;
+typedef std::vector<cv::Point> PointVector;
+
+// Scratch buffers for the detectors, see FilterWorkspace. Reusing one
+// workspace and one PointVector per video stream means no allocations per
+// frame once they have grown to size.
+//
+// With compact set, the gray image stays 8-bit and the derivatives are
+// int16 instead of float, which roughly halves the memory traffic of the
+// gradient and response passes. Both hold their values exactly, so the
+// points found are the same; the response maps stay float, since their
+// range is far beyond float16.
+//
+// denoise picks an edge-preserving filter (see Smoothing.h) to run on the
+// input before the detector's own Gaussian blur, for noisy sensor frames.
+enum Denoise { DENOISE_NONE, DENOISE_MEDIAN, DENOISE_BILATERAL };
+
+struct InterestWorkspace {
+    bool compact = false;
+    Denoise denoise = DENOISE_NONE;
+    FilterWorkspace filter;
+    SmoothingWorkspace smoothing;
+    cv::Mat denoised;
+    cv::Mat blurKernel;
+    cv::Mat blurred;
+    cv::Mat gray;
+    cv::Mat input;
+    cv::Mat dx;
+    cv::Mat dy;
+    cv::Mat response;   // Harris response or Moravec corner strength
+};
+
+// Compute Sum of Squared Differences of two regions (must be same size).
+// Currently expects single channel 32-bit float.
+float ssd(const cv::Mat &r1, const cv::Mat &r2);
+
+// Moravec corner detection: my cheesy version
+PointList moravec(const cv::Mat &image);
+void moravec(const cv::Mat &image, PointVector &points,
+             InterestWorkspace &workspace);
+
+// Harris corner detection (input is BGR, 8UC3)
+PointList harris(const cv::Mat &image);
+void harris(const cv::Mat &image, PointVector &points,
+            InterestWorkspace &workspace);
+
+// Same detector as harris(), with the same points, but the whole chain (blur
+// included) is fused into a single streaming pass through graph (see
+// Graph.h), so the only full-frame intermediate is the response it outputs.
+// Pass the same graph for every frame so its buffers get reused; it is
+// built on first use.
+PointList harris(const cv::Mat &image, Graph &graph);
+
+// Build the graph used by harris(image, graph). Its output is the Harris
+// response at each interest point and zero everywhere else.
+void buildHarrisGraph(Graph &graph);
+
+// Draw a small cross at each point
+cv::Mat renderInterestPoints(const PointList &points, const cv::Mat &image,
+                             cv::Scalar color);
+// Same, drawing straight into image
+void renderInterestPoints(const PointVector &points, cv::Mat &image,
+                          cv::Scalar color);
+
+#endif
@@ -0,0 +1,216 @@
+// Find and draw interest points in an image or video, or find them in a
+// whole video offline and write them out
+
+#include <opencv2/opencv.hpp>
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "InterestPoints.h"
+#include "RawImage.h"
+#include "Trace.h"
+#include "VideoPipeline.h"
+
+#define WINDOW_NAME "Interest point detector"
+
+// Offline modes: frames in flight per worker (decoded, being processed or
+// waiting to be written in order)
+#define FRAMES_PER_WORKER 2
+
+// Find Harris points in every frame of a video on all cores. With render
+// set, output is a video of the frames with the points drawn in; otherwise
+// it's a directory that gets one text file of "x y" lines per frame.
+static int detectVideo(cv::VideoCapture &capture, const std::string &output,
+                       Denoise denoise, bool render) {
+    int workers = defaultWorkers();
+    std::vector<InterestWorkspace> workspaces(workers);
+    for (int i = 0; i < workers; i++) {
+        workspaces[i].denoise = denoise;
+    }
+    // The point files go into output, so make sure it's there before any
+    // frame is decoded
+    if (!render) {
+        struct stat info;
+        if (mkdir(output.c_str(), 0777) != 0 && errno != EEXIST) {
+            std::cerr << "mkdir: " << output << ": " << strerror(errno)
+                      << "\n";
+            return 1;
+        }
+        if (stat(output.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+            std::cerr << output << ": not a directory\n";
+            return 1;
+        }
+    }
+    double fps = capture.get(CV_CAP_PROP_FPS);
+    cv::VideoWriter writer;
+    int frames = processVideo(capture, workers, workers * FRAMES_PER_WORKER,
+        [&workspaces, render](FrameJob &job, int worker) {
+            harris(job.frame, job.points, workspaces[worker]);
+            if (render) {
+                // Into the job's own buffer, which is reused across frames
+                job.frame.copyTo(job.result);
+                renderInterestPoints(job.points, job.result,
+                                     cv::Scalar(0, 0, 255));
+            }
+        },
+        [&writer, &output, fps, render](const FrameJob &job) {
+            if (render) {
+                // Opened on the first frame, once the frame size is known
+                if (!writer.isOpened() &&
+                    !writer.open(output, CV_FOURCC('M', 'J', 'P', 'G'),
+                                 fps > 0 ? fps : 30, job.result.size())) {
+                    std::cerr << "VideoWriter::open: " << output
+                              << " failed\n";
+                    return false;
+                }
+                writer.write(job.result);
+                return true;
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "/frame%06d.txt", job.index);
+            std::ofstream out((output + name).c_str());
+            for (size_t i = 0; i < job.points.size(); i++) {
+                out << job.points[i].x << " " << job.points[i].y << "\n";
+            }
+            if (!out) {
+                std::cerr << output << name << ": write failed\n";
+                return false;
+            }
+            return true;
+        });
+    std::cerr << "Processed " << frames << " frames using " << workers
+              << " threads\n";
+    return frames > 0 ? 0 : 1;
+}
+
+static void usage(const std::string &program) {
+    std::cerr << "Usage:\n"
+              << "  " << program << " -i [image path] [denoise]\n"
+              << "  " << program << " -v [video path] [denoise]\n"
+              << "  " << program << " -o [video path] [output video] "
+              << "[denoise]\n"
+              << "  " << program << " -p [video path] [output directory] "
+              << "[denoise]\n"
+              << "denoise (optional) is median or bilateral.\n"
+              << "-o and -p process the whole video offline, writing a video "
+              << "with the points\ndrawn in or a point file per frame.\n";
+}
+
+int main(int argc, char *argv[]) {
+    // Stage timings, when built with tracing (see Trace.h)
+    TRACE_DUMP_AT_EXIT();
+    bool offline = argc >= 2 && (strcmp(argv[1], "-o") == 0 ||
+                                 strcmp(argv[1], "-p") == 0);
+    int denoiseArg = offline ? 4 : 3;
+    if (argc != denoiseArg && argc != denoiseArg + 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    InterestWorkspace workspace;
+    if (argc == denoiseArg + 1) {
+        if (strcmp(argv[denoiseArg], "median") == 0) {
+            workspace.denoise = DENOISE_MEDIAN;
+        } else if (strcmp(argv[denoiseArg], "bilateral") == 0) {
+            workspace.denoise = DENOISE_BILATERAL;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (offline) {
+        cv::VideoCapture capture(argv[2]);
+        if (!capture.isOpened()) {
+            std::cerr << "VideoCapture::open failed\n";
+            return 1;
+        }
+        return detectVideo(capture, argv[3], workspace.denoise,
+                           strcmp(argv[1], "-o") == 0);
+    }
+
+    // Open up the source image or video
+    cv::Mat image;
+    RawImage raw;
+    cv::VideoCapture capture;
+    if (strcmp(argv[1], "-i") == 0) {
+        image = readImage(argv[2], raw);
+        if (!image.data) {
+            std::cerr << "readImage: " << argv[2] << ": nada\n";
+            return 1;
+        }
+    } else if (strcmp(argv[1], "-v") == 0) {
+        capture.open(argv[2]);
+        if (!capture.isOpened()) {
+            std::cerr << "VideoCapture::open failed\n";
+            return 1;
+        }
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Main loop
+    std::cerr << "Press ESC in the image window to quit.\n";
+    // Video frames go through the streaming version of harris, which keeps
+    // its buffers from one frame to the next (or, to denoise first, the
+    // workspace version).
+    Graph harrisGraph;
+    PointVector points;
+    while (true) {
+        char lastKeyPress = -1;
+        if (image.data) {
+            cv::Mat result = image.clone();
+            std::cerr << "Computing Harris interest points... ";
+            harris(image, points, workspace);
+            result = renderInterestPoints(PointList(points.begin(),
+                                                    points.end()),
+                                          result, cv::Scalar(0, 0, 255));
+            std::cerr << "Done.\n";
+            std::cerr << "Computing Moravec interest points... ";
+            moravec(image, points, workspace);
+            result = renderInterestPoints(PointList(points.begin(),
+                                                    points.end()),
+                                          result, cv::Scalar(0, 255, 0));
+            std::cerr << "Done.\n";
+            cv::imshow(WINDOW_NAME, result);
+            lastKeyPress = cv::waitKey(0);
+        } else {
+            TRACE_SCOPE("frame");
+            cv::Mat inFrame;
+            {
+                TRACE_SCOPE("decode");
+                if (!capture.grab()) {
+                    std::cerr << "grab failed\n";
+                    break;
+                }
+                capture.retrieve(inFrame);
+            }
+            if (inFrame.empty()) {
+                std::cerr << "empty frame\n";
+                break;
+            }
+            PointList framePoints;
+            if (workspace.denoise == DENOISE_NONE) {
+                framePoints = harris(inFrame, harrisGraph);
+            } else {
+                harris(inFrame, points, workspace);
+                framePoints.assign(points.begin(), points.end());
+            }
+            cv::Mat result = renderInterestPoints(framePoints, inFrame,
+                                                  cv::Scalar(0, 0, 255));
+            {
+                TRACE_SCOPE("display");
+                cv::imshow(WINDOW_NAME, result);
+            }
+            lastKeyPress = cv::waitKey(1);
+        }
+        if (lastKeyPress == 27) {
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,334 @@
+#include "RawImage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+static_assert(sizeof(RawImageHeader) <= RAW_IMAGE_HEADER_SIZE,
+              "raw image header doesn't fit");
+
+static size_t alignUp(size_t n, size_t alignment) {
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+// Header for an image of the given size and type; a tile width of 0 means
+// the image width
+static RawImageHeader makeHeader(cv::Size size, int type, cv::Size tileSize) {
+    RawImageHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RAW_IMAGE_MAGIC, sizeof(h.magic));
+    h.version = RAW_IMAGE_VERSION;
+    h.width = size.width;
+    h.height = size.height;
+    h.type = type;
+    h.tileWidth = tileSize.width > 0 ? std::min(tileSize.width, size.width) :
+                                       size.width;
+    h.tileHeight = tileSize.height > 0 ?
+                   std::min(tileSize.height, size.height) : size.height;
+    size_t rowBytes = h.tileWidth * CV_ELEM_SIZE(type);
+    h.tileStep = alignUp(rowBytes, RAW_IMAGE_ALIGNMENT);
+    h.tileBytes = h.tileStep * h.tileHeight;
+    h.dataOffset = RAW_IMAGE_HEADER_SIZE;
+    return h;
+}
+
+// The header, zero padded to RAW_IMAGE_HEADER_SIZE
+static void writeHeader(std::ofstream &out, const RawImageHeader &h) {
+    std::vector<char> block(RAW_IMAGE_HEADER_SIZE, 0);
+    memcpy(&block[0], &h, sizeof(h));
+    out.write(&block[0], block.size());
+}
+
+RawImage::RawImage() : data(NULL), length(0) {
+}
+
+RawImage::~RawImage() {
+    close();
+}
+
+bool RawImage::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "open: " << path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < RAW_IMAGE_HEADER_SIZE) {
+        std::cerr << path << ": not a raw image\n";
+        ::close(fd);
+        return false;
+    }
+    // Private and writable, so the Mats can be written to without touching
+    // the file (only pages that actually get written are copied).
+    void *mapped = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "mmap: " << path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    data = (uchar *)mapped;
+    length = st.st_size;
+
+    const RawImageHeader &h = header();
+    int elemSize = CV_ELEM_SIZE(h.type);
+    // Only plain Mat types: nothing but depth and channels set, and not
+    // depth 7 (CV_USRTYPE1, or CV_16F in newer OpenCV), which has no fixed
+    // element size here
+    bool validType = (h.type & ~CV_MAT_TYPE_MASK) == 0 &&
+                     CV_MAT_DEPTH(h.type) != 7 &&
+                     CV_MAT_DEPTH(h.type) <= CV_64F;
+    // Every field is bounded before it's multiplied, and the products that
+    // could still wrap are checked by dividing instead, so a crafted header
+    // can't pass the size check and then point outside the mapping.
+    bool valid = memcmp(h.magic, RAW_IMAGE_MAGIC, sizeof(h.magic)) == 0 &&
+                 h.version == RAW_IMAGE_VERSION &&
+                 h.width > 0 && h.height > 0 &&
+                 h.width <= RAW_IMAGE_MAX_SIZE &&
+                 h.height <= RAW_IMAGE_MAX_SIZE && validType &&
+                 h.tileWidth > 0 && h.tileHeight > 0 &&
+                 h.tileWidth <= h.width && h.tileHeight <= h.height &&
+                 h.tileStep >= (uint64_t)h.tileWidth * elemSize &&
+                 h.tileStep % RAW_IMAGE_ALIGNMENT == 0 &&
+                 h.tileBytes / h.tileHeight >= h.tileStep &&
+                 h.tileBytes % RAW_IMAGE_ALIGNMENT == 0 &&
+                 h.dataOffset >= RAW_IMAGE_HEADER_SIZE &&
+                 h.dataOffset % RAW_IMAGE_ALIGNMENT == 0 &&
+                 h.dataOffset <= length;
+    if (valid) {
+        // Both at most RAW_IMAGE_MAX_SIZE, so this can't wrap
+        uint64_t tiles = (uint64_t)tilesAcross() * tilesDown();
+        valid = tiles <= INT_MAX &&
+                tiles <= (length - h.dataOffset) / h.tileBytes;
+    }
+    if (!valid) {
+        std::cerr << path << ": not a raw image (or a damaged one)\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void RawImage::close() {
+    if (data) {
+        munmap(data, length);
+    }
+    data = NULL;
+    length = 0;
+}
+
+cv::Size RawImage::size() const {
+    return cv::Size(header().width, header().height);
+}
+
+int RawImage::type() const {
+    return header().type;
+}
+
+cv::Size RawImage::tileSize() const {
+    return cv::Size(header().tileWidth, header().tileHeight);
+}
+
+int RawImage::tilesAcross() const {
+    return (header().width + header().tileWidth - 1) / header().tileWidth;
+}
+
+int RawImage::tilesDown() const {
+    return (header().height + header().tileHeight - 1) / header().tileHeight;
+}
+
+cv::Mat RawImage::tile(int col, int row) const {
+    const RawImageHeader &h = header();
+    int x = col * h.tileWidth;
+    int y = row * h.tileHeight;
+    uchar *start = data + h.dataOffset +
+                   (size_t)(row * tilesAcross() + col) * h.tileBytes;
+    return cv::Mat(std::min<int>(h.tileHeight, h.height - y),
+                   std::min<int>(h.tileWidth, h.width - x), h.type, start,
+                   h.tileStep);
+}
+
+cv::Mat RawImage::mat() const {
+    const RawImageHeader &h = header();
+    if (tilesAcross() == 1 && h.tileBytes == h.tileStep * h.tileHeight) {
+        // Strips follow each other with no gap, so rows are evenly spaced
+        return cv::Mat(h.height, h.width, h.type, data + h.dataOffset,
+                       h.tileStep);
+    }
+    cv::Mat result(size(), type());
+    for (int row = 0; row < tilesDown(); row++) {
+        for (int col = 0; col < tilesAcross(); col++) {
+            cv::Mat t = tile(col, row);
+            t.copyTo(result(cv::Rect(col * h.tileWidth, row * h.tileHeight,
+                                     t.cols, t.rows)));
+        }
+    }
+    return result;
+}
+
+cv::Mat RawImage::rows(int y, int count, cv::Mat &buffer) const {
+    const RawImageHeader &h = header();
+    if (tilesAcross() == 1 && h.tileBytes == h.tileStep * h.tileHeight) {
+        return mat().rowRange(y, y + count);
+    }
+    buffer.create(count, h.width, h.type);
+    for (int row = y / h.tileHeight; row * (int)h.tileHeight < y + count;
+         row++) {
+        int top = row * h.tileHeight;
+        for (int col = 0; col < tilesAcross(); col++) {
+            cv::Mat t = tile(col, row);
+            // Only the part of the tile inside [y, y + count)
+            int first = std::max(y - top, 0);
+            int last = std::min(y + count - top, t.rows);
+            t.rowRange(first, last).copyTo(buffer(cv::Rect(
+                col * h.tileWidth, top + first - y, t.cols, last - first)));
+        }
+    }
+    return buffer;
+}
+
+void RawImage::release(int y) {
+    const RawImageHeader &h = header();
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t tileRows = std::min<size_t>(std::max(y, 0), h.height) /
+                      h.tileHeight;
+    // Whole pages only, between the header and the first row still needed
+    size_t start = alignUp(h.dataOffset, pageSize);
+    size_t end = (h.dataOffset + tileRows * tilesAcross() * h.tileBytes) /
+                 pageSize * pageSize;
+    if (end > start) {
+        madvise(data + start, end - start, MADV_DONTNEED);
+    }
+}
+
+bool RawImage::write(const std::string &path, const cv::Mat &image,
+                     cv::Size tileSize) {
+    if (image.empty()) {
+        std::cerr << "RawImage::write: empty image\n";
+        return false;
+    }
+    if (image.cols > RAW_IMAGE_MAX_SIZE || image.rows > RAW_IMAGE_MAX_SIZE) {
+        std::cerr << "RawImage::write: image too big\n";
+        return false;
+    }
+    RawImageHeader h = makeHeader(image.size(), image.type(), tileSize);
+    std::ofstream out(path.c_str(), std::ios::binary);
+    writeHeader(out, h);
+
+    std::vector<char> block(h.tileBytes);
+    for (int y = 0; y < image.rows; y += h.tileHeight) {
+        for (int x = 0; x < image.cols; x += h.tileWidth) {
+            std::fill(block.begin(), block.end(), 0);
+            int rows = std::min<int>(h.tileHeight, image.rows - y);
+            int cols = std::min<int>(h.tileWidth, image.cols - x);
+            for (int r = 0; r < rows; r++) {
+                const uchar *src = image.ptr(y + r) + x * image.elemSize();
+                memcpy(&block[r * h.tileStep], src, cols * image.elemSize());
+            }
+            out.write(&block[0], block.size());
+        }
+    }
+    if (!out) {
+        std::cerr << "RawImage::write: " << path << ": write failed\n";
+        return false;
+    }
+    return true;
+}
+
+RawImageWriter::RawImageWriter() : rowsWritten(0) {
+    memset(&h, 0, sizeof(h));
+}
+
+RawImageWriter::~RawImageWriter() {
+    if (out.is_open()) {
+        close();
+    }
+}
+
+bool RawImageWriter::open(const std::string &path, cv::Size size, int type,
+                          int stripHeight) {
+    if (size.width <= 0 || size.height <= 0) {
+        std::cerr << "RawImageWriter::open: empty image\n";
+        return false;
+    }
+    if (size.width > RAW_IMAGE_MAX_SIZE || size.height > RAW_IMAGE_MAX_SIZE) {
+        std::cerr << "RawImageWriter::open: image too big\n";
+        return false;
+    }
+    h = makeHeader(size, type, cv::Size(0, stripHeight));
+    rowsWritten = 0;
+    row.assign(h.tileStep, 0);
+    out.open(path.c_str(), std::ios::binary);
+    writeHeader(out, h);
+    if (!out) {
+        std::cerr << "RawImageWriter::open: " << path << ": write failed\n";
+        out.close();
+        return false;
+    }
+    this->path = path;
+    return true;
+}
+
+bool RawImageWriter::write(const cv::Mat &rows) {
+    if (!out.is_open() || rows.cols != (int)h.width || rows.type() != h.type ||
+        rowsWritten + rows.rows > (int)h.height) {
+        std::cerr << "RawImageWriter::write: rows don't fit the image\n";
+        return false;
+    }
+    size_t rowBytes = rows.cols * rows.elemSize();
+    for (int y = 0; y < rows.rows; y++) {
+        memcpy(&row[0], rows.ptr(y), rowBytes);
+        out.write(&row[0], row.size());
+    }
+    rowsWritten += rows.rows;
+    return (bool)out;
+}
+
+bool RawImageWriter::close() {
+    if (!out.is_open()) {
+        return false;
+    }
+    bool complete = rowsWritten == (int)h.height;
+    if (!complete) {
+        std::cerr << "RawImageWriter::close: " << path << ": only "
+                  << rowsWritten << " of " << h.height << " rows written\n";
+    }
+    // Zero pad the last strip to full size
+    std::fill(row.begin(), row.end(), 0);
+    for (int y = h.height; y % h.tileHeight != 0; y++) {
+        out.write(&row[0], row.size());
+    }
+    out.close();
+    if (!out) {
+        std::cerr << "RawImageWriter::close: " << path << ": write failed\n";
+        return false;
+    }
+    return complete;
+}
+
+bool RawImage::isRawImage(const std::string &path) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    char magic[8];
+    return in.read(magic, sizeof(magic)) &&
+           memcmp(magic, RAW_IMAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+cv::Mat readImage(const std::string &path, RawImage &raw) {
+    if (RawImage::isRawImage(path)) {
+        if (!raw.open(path)) {
+            return cv::Mat();
+        }
+        return raw.mat();
+    }
+    return cv::imread(path);
+}
@@ -0,0 +1,134 @@
+#ifndef __CV_RAW_IMAGE_H__
+#define __CV_RAW_IMAGE_H__
+
+#include <opencv2/opencv.hpp>
+
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// A raw tiled image container, for corpora that get processed over and over
+// and shouldn't be decoded from JPEG/PNG every time.
+//
+// Layout: a 4096 byte header (RawImageHeader, rest zero), then the tiles in
+// row-major order. Every tile has the full tile size (edge tiles are zero
+// padded), and each tile row is padded to a multiple of 64 bytes, so every
+// tile and every row starts cache line aligned. When tiles span the whole
+// width (strips, the default), the rows of consecutive strips are evenly
+// spaced and the whole image is a single cv::Mat over the file.
+//
+// Reading maps the file copy-on-write: pixels are paged in from the page
+// cache on first touch and only pages that get written become private.
+
+#define RAW_IMAGE_MAGIC       "CVRAWIMG"
+#define RAW_IMAGE_VERSION     1
+#define RAW_IMAGE_HEADER_SIZE 4096
+#define RAW_IMAGE_ALIGNMENT   64
+#define RAW_IMAGE_MAX_SIZE    (1 << 20)   // pixels, per dimension
+
+struct RawImageHeader {
+    char magic[8];          // RAW_IMAGE_MAGIC, not NUL terminated
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    int32_t type;           // OpenCV type, e.g. CV_8UC3
+    uint32_t tileWidth;
+    uint32_t tileHeight;
+    uint64_t tileStep;      // bytes per tile row
+    uint64_t tileBytes;     // bytes per tile
+    uint64_t dataOffset;    // first tile, from the start of the file
+};
+
+class RawImage {
+
+  public:
+    RawImage();
+    ~RawImage();
+
+    // Map a raw image file. Returns false, with a message on stderr, if
+    // that doesn't work out.
+    bool open(const std::string &path);
+    void close();
+
+    bool isOpen() const { return data != NULL; }
+    cv::Size size() const;
+    int type() const;
+    cv::Size tileSize() const;
+    int tilesAcross() const;
+    int tilesDown() const;
+
+    // Tile (col, row), clipped to the image. Points into the mapping, so
+    // it's only valid while this RawImage stays open.
+    cv::Mat tile(int col, int row) const;
+
+    // The whole image. Points into the mapping for strip layouts; for
+    // narrower tiles the tiles are copied into a new Mat.
+    cv::Mat mat() const;
+
+    // Rows [y, y + count), full width. Points into the mapping for strip
+    // layouts; for narrower tiles they are copied into buffer.
+    cv::Mat rows(int y, int count, cv::Mat &buffer) const;
+
+    // Done with the rows above y: drop their pages from memory, so reading
+    // a big image band by band only keeps about a band resident. Mats
+    // over those rows read the file again if used later (any changes
+    // made through them are lost).
+    void release(int y);
+
+    // Write image in raw format. A tile width of 0 means the image width,
+    // i.e. strips.
+    static bool write(const std::string &path, const cv::Mat &image,
+                      cv::Size tileSize = cv::Size(0, 64));
+
+    // Whether path starts with a raw image header
+    static bool isRawImage(const std::string &path);
+
+  private:
+    RawImage(const RawImage &);
+    RawImage &operator=(const RawImage &);
+
+    const RawImageHeader &header() const {
+        return *(const RawImageHeader *)data;
+    }
+
+    uchar *data;
+    size_t length;
+};
+
+// Writes a raw image (strip layout) a band of rows at a time, for results
+// too big to hold in memory all at once.
+class RawImageWriter {
+
+  public:
+    RawImageWriter();
+    ~RawImageWriter();
+
+    bool open(const std::string &path, cv::Size size, int type,
+              int stripHeight = 64);
+
+    // Append rows (full width, of the image type) below the ones written
+    // so far
+    bool write(const cv::Mat &rows);
+
+    // Finish the file. False if not all rows were written or writing
+    // failed.
+    bool close();
+
+  private:
+    RawImageWriter(const RawImageWriter &);
+    RawImageWriter &operator=(const RawImageWriter &);
+
+    std::string path;
+    std::ofstream out;
+    RawImageHeader h;
+    int rowsWritten;
+    std::vector<char> row;  // one padded row
+};
+
+// Load an image for processing: raw images are mapped into raw (so the
+// result is valid while raw is open), anything else goes through
+// cv::imread. Returns an empty Mat if neither works.
+cv::Mat readImage(const std::string &path, RawImage &raw);
+
+#endif
@@ -0,0 +1,257 @@
+#include "Smoothing.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+
+#include "Filter.h"
+#include "Trace.h"
+
+// Grid cells outside the image, so the 5 tap blur never needs clamping
+#define GRID_PADDING 2
+
+// Histograms: 256 fine bins followed by 16 coarse bins (16 values each)
+#define FINE_BINS    256
+#define COARSE_BINS  16
+#define HIST_SIZE    (FINE_BINS + COARSE_BINS)
+
+#define MAX_MEDIAN_RADIUS 127 // so window counts fit in 16 bits
+
+cv::Mat bilateralGrid(const cv::Mat &image, float sigmaSpace,
+                      float sigmaRange) {
+    SmoothingWorkspace workspace;
+    cv::Mat result;
+    bilateralGrid(image, sigmaSpace, sigmaRange, result, workspace);
+    return result;
+}
+
+// Blur the grid along one axis with [1 4 6 4 1] / 16. Cells are 4 floats
+// (B, G, R sum and weight); along the axis they are stride cells apart,
+// and there are length of them.
+static void blurGridAxis(const cv::Mat &src, cv::Mat &dst, int stride,
+                         int length) {
+    static const float taps[5] = {
+        1/16.0f, 4/16.0f, 6/16.0f, 4/16.0f, 1/16.0f
+    };
+    dst.create(src.size(), src.type());
+    const float *in = src.ptr<float>();
+    float *out = dst.ptr<float>();
+    size_t cells = src.total();
+    for (size_t i = 0; i < cells; i++) {
+        int position = (i / stride) % length;
+        float sum[4] = { 0, 0, 0, 0 };
+        for (int k = -2; k <= 2; k++) {
+            if (position + k < 0 || position + k >= length) {
+                continue;
+            }
+            const float *cell = in + (i + (ptrdiff_t)k * stride) * 4;
+            for (int c = 0; c < 4; c++) {
+                sum[c] += taps[k+2] * cell[c];
+            }
+        }
+        memcpy(out + i * 4, sum, sizeof(sum));
+    }
+}
+
+void bilateralGrid(const cv::Mat &image, float sigmaSpace, float sigmaRange,
+                   cv::Mat &dst, SmoothingWorkspace &workspace) {
+    TRACE_SCOPE("bilateral_grid");
+    if (image.type() != CV_8UC3) {
+        std::cerr << "bilateralGrid only supports 8UC3 images right now\n";
+        image.copyTo(dst);
+        return;
+    }
+    sigmaSpace = std::max(sigmaSpace, 1.0f);
+    sigmaRange = std::max(sigmaRange, 1.0f);
+    bgrToGray(image, workspace.gray);
+
+    const int gridWidth = (int)((image.cols - 1) / sigmaSpace) + 1 +
+                          2 * GRID_PADDING;
+    const int gridHeight = (int)((image.rows - 1) / sigmaSpace) + 1 +
+                           2 * GRID_PADDING;
+    const int gridDepth = (int)(255 / sigmaRange) + 1 + 2 * GRID_PADDING;
+    // Slices of constant intensity, one above the other
+    cv::Mat &grid = workspace.grid;
+    grid.create(gridDepth * gridHeight, gridWidth, CV_32FC4);
+    memset(grid.ptr(), 0, grid.total() * grid.elemSize());
+
+    {
+        TRACE_SCOPE("bilateral_grid/splat");
+        for (int y = 0; y < image.rows; y++) {
+            const uchar *src = image.ptr<uchar>(y);
+            const uchar *gray = workspace.gray.ptr<uchar>(y);
+            int gy = cvRound(y / sigmaSpace) + GRID_PADDING;
+            for (int x = 0; x < image.cols; x++, src += 3) {
+                int gx = cvRound(x / sigmaSpace) + GRID_PADDING;
+                int gz = cvRound(gray[x] / sigmaRange) + GRID_PADDING;
+                float *cell = grid.ptr<float>(gz * gridHeight + gy) + gx * 4;
+                cell[0] += src[0];
+                cell[1] += src[1];
+                cell[2] += src[2];
+                cell[3] += 1;
+            }
+        }
+    }
+    {
+        TRACE_SCOPE("bilateral_grid/blur");
+        blurGridAxis(grid, workspace.gridBlur, 1, gridWidth);
+        blurGridAxis(workspace.gridBlur, grid, gridWidth, gridHeight);
+        blurGridAxis(grid, workspace.gridBlur, gridWidth * gridHeight,
+                     gridDepth);
+    }
+
+    TRACE_SCOPE("bilateral_grid/slice");
+    const cv::Mat &blurred = workspace.gridBlur;
+    dst.create(image.size(), CV_8UC3);
+    for (int y = 0; y < image.rows; y++) {
+        const uchar *src = image.ptr<uchar>(y);
+        const uchar *gray = workspace.gray.ptr<uchar>(y);
+        uchar *out = dst.ptr<uchar>(y);
+        float fy = y / sigmaSpace + GRID_PADDING;
+        int iy = (int)fy;
+        float ty = fy - iy;
+        for (int x = 0; x < image.cols; x++) {
+            float fx = x / sigmaSpace + GRID_PADDING;
+            float fz = gray[x] / sigmaRange + GRID_PADDING;
+            int ix = (int)fx;
+            int iz = (int)fz;
+            float tx = fx - ix;
+            float tz = fz - iz;
+            // Trilinear interpolation between the 8 surrounding cells
+            float value[4] = { 0, 0, 0, 0 };
+            for (int dz = 0; dz <= 1; dz++) {
+                for (int dy = 0; dy <= 1; dy++) {
+                    const float *cell =
+                        blurred.ptr<float>((iz + dz) * gridHeight + iy + dy) +
+                        ix * 4;
+                    float wzy = (dz ? tz : 1 - tz) * (dy ? ty : 1 - ty);
+                    for (int c = 0; c < 4; c++) {
+                        value[c] += wzy * ((1 - tx) * cell[c] +
+                                           tx * cell[4 + c]);
+                    }
+                }
+            }
+            for (int c = 0; c < 3; c++) {
+                out[x*3 + c] = value[3] > 0 ?
+                    cv::saturate_cast<uchar>(value[c] / value[3]) :
+                    src[x*3 + c];
+            }
+        }
+    }
+}
+
+cv::Mat medianFilter(const cv::Mat &image, int radius) {
+    SmoothingWorkspace workspace;
+    cv::Mat result;
+    medianFilter(image, radius, result, workspace);
+    return result;
+}
+
+static inline void addHistogram(uint16_t *to, const uint16_t *from) {
+    for (int i = 0; i < HIST_SIZE; i++) {
+        to[i] += from[i];
+    }
+}
+
+static inline void subtractHistogram(uint16_t *from, const uint16_t *what) {
+    for (int i = 0; i < HIST_SIZE; i++) {
+        from[i] -= what[i];
+    }
+}
+
+// Value with the given rank (0 based) in the histogram: find the coarse
+// bin first, then the fine bin inside it.
+static inline uchar histogramRank(const uint16_t *histogram, int rank) {
+    const uint16_t *coarse = histogram + FINE_BINS;
+    int bin = 0;
+    while (rank >= coarse[bin]) {
+        rank -= coarse[bin];
+        bin++;
+    }
+    int value = bin * (FINE_BINS / COARSE_BINS);
+    while (rank >= histogram[value]) {
+        rank -= histogram[value];
+        value++;
+    }
+    return value;
+}
+
+void medianFilter(const cv::Mat &image, int radius, cv::Mat &dst,
+                  SmoothingWorkspace &workspace) {
+    TRACE_SCOPE("median");
+    if (image.depth() != CV_8U || image.channels() > 4) {
+        std::cerr << "medianFilter only supports 8-bit images right now\n";
+        image.copyTo(dst);
+        return;
+    }
+    if (radius > MAX_MEDIAN_RADIUS) {
+        std::cerr << "medianFilter radius " << radius << " too big, using "
+                  << MAX_MEDIAN_RADIUS << "\n";
+        radius = MAX_MEDIAN_RADIUS;
+    }
+    radius = std::max(radius, 0);
+    const int width = image.cols;
+    const int height = image.rows;
+    const int channels = image.channels();
+    const int rank = (2*radius + 1) * (2*radius + 1) / 2;
+    dst.create(image.size(), image.type());
+
+    // One histogram per column and channel, of the 2*radius+1 pixels above
+    // and below the current row (rows past the edges replicated)
+    std::vector<uint16_t> &columns = workspace.columns;
+    columns.assign((size_t)width * channels * HIST_SIZE, 0);
+    for (int j = -radius; j <= radius; j++) {
+        const uchar *src = image.ptr<uchar>(std::min(std::max(j, 0),
+                                                     height - 1));
+        for (int i = 0; i < width * channels; i++) {
+            uint16_t *column = &columns[(size_t)i * HIST_SIZE];
+            column[src[i]]++;
+            column[FINE_BINS + src[i] / (FINE_BINS / COARSE_BINS)]++;
+        }
+    }
+
+    uint16_t window[4][HIST_SIZE];
+    for (int y = 0; y < height; y++) {
+        if (y > 0) {
+            // Slide the column histograms down a row
+            const uchar *leaving = image.ptr<uchar>(std::max(y - radius - 1,
+                                                             0));
+            const uchar *entering = image.ptr<uchar>(std::min(y + radius,
+                                                              height - 1));
+            for (int i = 0; i < width * channels; i++) {
+                uint16_t *column = &columns[(size_t)i * HIST_SIZE];
+                column[leaving[i]]--;
+                column[FINE_BINS + leaving[i] / (FINE_BINS/COARSE_BINS)]--;
+                column[entering[i]]++;
+                column[FINE_BINS + entering[i] / (FINE_BINS/COARSE_BINS)]++;
+            }
+        }
+
+        // Window histogram for x = 0 from scratch, then slide it along the
+        // row a column at a time
+        memset(window, 0, sizeof(window));
+        for (int i = -radius; i <= radius; i++) {
+            int x = std::min(std::max(i, 0), width - 1);
+            for (int c = 0; c < channels; c++) {
+                addHistogram(window[c],
+                             &columns[((size_t)x * channels + c) * HIST_SIZE]);
+            }
+        }
+        uchar *out = dst.ptr<uchar>(y);
+        for (int x = 0; x < width; x++) {
+            if (x > 0) {
+                int leaving = std::max(x - radius - 1, 0);
+                int entering = std::min(x + radius, width - 1);
+                for (int c = 0; c < channels; c++) {
+                    subtractHistogram(window[c], &columns[
+                        ((size_t)leaving * channels + c) * HIST_SIZE]);
+                    addHistogram(window[c], &columns[
+                        ((size_t)entering * channels + c) * HIST_SIZE]);
+                }
+            }
+            for (int c = 0; c < channels; c++) {
+                out[x * channels + c] = histogramRank(window[c], rank);
+            }
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef __CV_SMOOTHING_H__
+#define __CV_SMOOTHING_H__
+
+#include <opencv2/opencv.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+// Edge-preserving (non-linear) smoothing whose cost per pixel doesn't
+// depend on the radius, for denoising before feature detection.
+
+// Scratch buffers, reused the same way as FilterWorkspace
+struct SmoothingWorkspace {
+    cv::Mat gray;
+    cv::Mat grid;
+    cv::Mat gridBlur;
+    std::vector<uint16_t> columns;  // median: one histogram per column
+};
+
+// Bilateral filter on a bilateral grid (Chen, Paris & Durand '07): pixels
+// are splatted into a 3D grid downsampled by sigmaSpace in x and y and by
+// sigmaRange in intensity, the grid is blurred, and the result is sliced
+// back out with trilinear interpolation. Edges are found on the gray image;
+// 8UC3 in and out.
+cv::Mat bilateralGrid(const cv::Mat &image, float sigmaSpace,
+                      float sigmaRange);
+void bilateralGrid(const cv::Mat &image, float sigmaSpace, float sigmaRange,
+                   cv::Mat &dst, SmoothingWorkspace &workspace);
+
+// Median over a (2*radius+1)^2 window, per channel, with replicated borders
+// (same result as cv::medianBlur). Uses per-column histograms that are
+// updated incrementally (Perreault & Hébert '07), so the cost doesn't grow
+// with the radius. 8-bit images, radius up to 127.
+cv::Mat medianFilter(const cv::Mat &image, int radius);
+void medianFilter(const cv::Mat &image, int radius, cv::Mat &dst,
+                  SmoothingWorkspace &workspace);
+
+#endif
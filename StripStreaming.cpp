@@ -0,0 +1,90 @@
+#include "StripStreaming.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "Filter.h"
+#include "Smoothing.h"
+#include "Trace.h"
+
+bool processStrips(RawImage &in, const std::string &outPath, int stripRows,
+                   int halo, const BandOperation &operation) {
+    TRACE_SCOPE("strips");
+    const int height = in.size().height;
+    stripRows = std::max(stripRows, 1);
+    halo = std::max(halo, 0);
+    RawImageWriter out;
+    cv::Mat buffer, result;
+    for (int y = 0; y < height; y += stripRows) {
+        int rows = std::min(stripRows, height - y);
+        int top = std::max(y - halo, 0);
+        int bottom = std::min(y + rows + halo, height);
+        cv::Mat band = in.rows(top, bottom - top, buffer);
+        {
+            TRACE_SCOPE("strips/band");
+            operation(band, result);
+        }
+        if (result.size() != band.size()) {
+            std::cerr << "processStrips: result doesn't match the band\n";
+            return false;
+        }
+        if (y == 0 && !out.open(outPath, in.size(), result.type())) {
+            return false;
+        }
+        if (!out.write(result.rowRange(y - top, y - top + rows))) {
+            return false;
+        }
+        // The next band starts halo rows above its first output row
+        in.release(y + rows - halo);
+    }
+    return out.close();
+}
+
+bool filterStrips(RawImage &in, const cv::Mat &kernel,
+                  const std::string &outPath, int stripRows) {
+    FilterWorkspace workspace;
+    return processStrips(in, outPath, stripRows, kernel.rows / 2,
+        [&kernel, &workspace](const cv::Mat &band, cv::Mat &result) {
+            filter(band, kernel, result, workspace);
+        });
+}
+
+bool medianStrips(RawImage &in, int radius, const std::string &outPath,
+                  int stripRows) {
+    SmoothingWorkspace workspace;
+    return processStrips(in, outPath, stripRows, radius,
+        [radius, &workspace](const cv::Mat &band, cv::Mat &result) {
+            medianFilter(band, radius, result, workspace);
+        });
+}
+
+bool histogramStrips(RawImage &in, Histogram &histogram, int stripRows) {
+    TRACE_SCOPE("strips/histogram");
+    if (in.type() != CV_8UC3) {
+        std::cerr << "histogramStrips only supports 8UC3 images\n";
+        return false;
+    }
+    const int height = in.size().height;
+    stripRows = std::max(stripRows, 1);
+    histogram = Histogram();
+    cv::Mat buffer;
+    for (int y = 0; y < height; y += stripRows) {
+        int rows = std::min(stripRows, height - y);
+        histogram.add(in.rows(y, rows, buffer));
+        in.release(y + rows);
+    }
+    return true;
+}
+
+bool equalHistogramStrips(RawImage &in, const std::string &outPath,
+                          int stripRows) {
+    Histogram histogram;
+    if (!histogramStrips(in, histogram, stripRows)) {
+        return false;
+    }
+    Histogram cumulative = histogram.cumulative();
+    return processStrips(in, outPath, stripRows, 0,
+        [&cumulative](const cv::Mat &band, cv::Mat &result) {
+            equalHistogram(band, cumulative, result);
+        });
+}
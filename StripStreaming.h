@@ -0,0 +1,46 @@
+#ifndef __CV_STRIP_STREAMING_H__
+#define __CV_STRIP_STREAMING_H__
+
+#include <opencv2/opencv.hpp>
+
+#include <functional>
+#include <string>
+
+#include "Histogram.h"
+#include "RawImage.h"
+
+// Out-of-core processing of raw images (RawImage.h) that are too big to
+// process in memory. The input is read in horizontal bands. Each band also
+// gets the extra rows above and below it (the halo) that the operation
+// needs. Results are written to a raw image one band at a time, and pages
+// of the input that are no longer needed get dropped. Peak memory depends
+// on the band size, not the image size. Output is identical to running the
+// operation on the whole image, provided each output row only depends on
+// input rows within halo rows of it.
+
+// Runs on one band of input rows (halo included, clipped to the image) and
+// writes result with the same size.
+typedef std::function<void(const cv::Mat &band, cv::Mat &result)>
+    BandOperation;
+
+// Apply operation to in, stripRows output rows at a time, and write the
+// result to outPath as a raw image. Returns false, with a message on
+// stderr, if that doesn't work out.
+bool processStrips(RawImage &in, const std::string &outPath, int stripRows,
+                   int halo, const BandOperation &operation);
+
+// filter(image, kernel) and medianFilter(image, radius), band by band
+bool filterStrips(RawImage &in, const cv::Mat &kernel,
+                  const std::string &outPath, int stripRows);
+bool medianStrips(RawImage &in, int radius, const std::string &outPath,
+                  int stripRows);
+
+// Histogram of a BGR (8UC3) raw image, read band by band
+bool histogramStrips(RawImage &in, Histogram &histogram, int stripRows);
+
+// equalHistogram(image), in two passes over the bands: one for the
+// histogram and one to equalize
+bool equalHistogramStrips(RawImage &in, const std::string &outPath,
+                          int stripRows);
+
+#endif
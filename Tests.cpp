@@ -1,8 +1,22 @@
 // Quick & dirty test suite.
 
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include <algorithm>
+#include <set>
+#include <utility>
+
+#include "AllocCounter.h"
+#include "ColorLut.h"
 #include "Filter.h"
+#include "Graph.h"
+#include "Histogram.h"
+#include "InterestPoints.h"
+#include "RawImage.h"
+#include "Smoothing.h"
+#include "StripStreaming.h"
 
 int testGaussian() {
     printf("A 5x5 gaussian kernel (sigma=1):\n");
@@ -15,8 +29,459 @@ int testGaussian() {
     return 0;
 }
 
+// Baked LUT should agree with evaluating the pipeline directly, give or
+// take interpolation error.
+int testColorLut() {
+    ColorPipeline pipeline;
+    pipeline.then(gammaOp(1/2.2f))
+            .then(gainOp(cv::Vec3f(0.8f, 1.0f, 1.3f)))
+            .then(gammaOp(2.2f))
+            .then(saturationOp(1.2f));
+    cv::Mat image(64, 64, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat baked = pipeline.bake().apply(image);
+    int worst = 0;
+    for (int y = 0; y < image.rows; y++) {
+        for (int x = 0; x < image.cols; x++) {
+            const cv::Vec3b &in = image.at<cv::Vec3b>(y, x);
+            cv::Vec3f expected = pipeline(cv::Vec3f(in[0], in[1], in[2]));
+            for (int c = 0; c < 3; c++) {
+                int diff = abs(baked.at<cv::Vec3b>(y, x)[c] -
+                               cv::saturate_cast<uchar>(expected[c]));
+                worst = std::max(worst, diff);
+            }
+        }
+    }
+    printf("Color LUT: worst error %d\n", worst);
+    return worst > 3;
+}
+
+// Balance then equalize, baked into one LUT, against doing each step on
+// the whole image. The LUT's own histogram and single-color lookups have
+// to agree with apply() too.
+int testEqualizedLut() {
+    cv::Mat image(60, 80, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(64));
+    for (int y = 0; y < image.rows; y++) {
+        for (int x = 0; x < image.cols; x++) {
+            cv::Vec3b &p = image.at<cv::Vec3b>(y, x);
+            p[0] += x * 2;
+            p[1] += y * 3;
+            p[2] += (x + y) % 50;
+        }
+    }
+    ColorPipeline balance;
+    balance.then(gammaOp(1/2.2f))
+           .then(gainOp(cv::Vec3f(0.9f, 1.0f, 1.2f)))
+           .then(gammaOp(2.2f));
+    ColorLut balanceLut = balance.bake();
+    cv::Mat balanced = balanceLut.apply(image);
+
+    Histogram counted = balanceLut.histogram(image);
+    Histogram expected(balanced);
+    bool sameHistogram = true;
+    for (int v = 0; v < 256; v++) {
+        sameHistogram = sameHistogram && counted.blue[v] == expected.blue[v] &&
+                        counted.green[v] == expected.green[v] &&
+                        counted.red[v] == expected.red[v];
+    }
+    int worstLookup = 0;
+    for (int y = 0; y < image.rows; y++) {
+        for (int x = 0; x < image.cols; x++) {
+            const cv::Vec3b &in = image.at<cv::Vec3b>(y, x);
+            cv::Vec3f out = balanceLut(cv::Vec3f(in[0], in[1], in[2]));
+            for (int c = 0; c < 3; c++) {
+                worstLookup = std::max(worstLookup,
+                    abs(cv::saturate_cast<uchar>(out[c]) -
+                        balanced.at<cv::Vec3b>(y, x)[c]));
+            }
+        }
+    }
+
+    cv::Mat fused = equalizedLut(balance, image).apply(image);
+    cv::Mat separate = equalHistogram(balanced);
+    double worst = cv::norm(fused, separate, cv::NORM_INF);
+    double mean = cv::norm(fused, separate, cv::NORM_L1) / fused.total() / 3;
+    printf("Equalized LUT: %s histogram, worst lookup error %d, "
+           "vs. equalHistogram worst %.0f mean %.2f\n",
+           sameHistogram ? "same" : "DIFFERENT", worstLookup, worst, mean);
+    return !sameHistogram || worstLookup > 1 || worst > 6 || mean > 1;
+}
+
+// Results far past 0-255 (and past int range) have to clamp, the same way
+// on the SSE and scalar paths. Odd width so pixels land everywhere.
+int testColorLutOverflow() {
+    ColorLut lut = ColorPipeline().then(
+        gainOp(cv::Vec3f(1e12f, -1e12f, 3))).bake();
+    cv::Mat image(17, 31, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    image.at<cv::Vec3b>(0, 0) = cv::Vec3b(0, 0, 0);
+    cv::Mat result = lut.apply(image);
+    int wrong = 0;
+    for (int y = 0; y < image.rows; y++) {
+        for (int x = 0; x < image.cols; x++) {
+            const cv::Vec3b &in = image.at<cv::Vec3b>(y, x);
+            const cv::Vec3b &out = result.at<cv::Vec3b>(y, x);
+            if (out[0] != (in[0] ? 255 : 0) || out[1] != 0 ||
+                abs(out[2] - std::min(3 * in[2], 255)) > 1) {
+                wrong++;
+            }
+        }
+    }
+    printf("Color LUT overflow: %d wrong pixels\n", wrong);
+    return wrong != 0;
+}
+
+// Streaming convolution should match filter() up to rounding
+int testGraphConvolve() {
+    cv::Mat image(48, 64, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat kernel = dogKernel(cv::Size(5, 5), 30);
+    Graph graph;
+    graph.then(new ConvolveStage(kernel, 3));
+    cv::Mat streamed;
+    graph.run(image).convertTo(streamed, CV_8UC3);
+    cv::Mat expected = filter(image, kernel);
+    cv::Mat diff;
+    cv::absdiff(streamed, expected, diff);
+    double worst;
+    cv::minMaxLoc(diff.reshape(1), NULL, &worst);
+    printf("Graph convolution: worst error %g\n", worst);
+    return worst > 1;
+}
+
+static std::set<std::pair<int, int> > pointSet(const PointList &points) {
+    std::set<std::pair<int, int> > result;
+    for (PointList::const_iterator p = points.begin(); p != points.end();
+         ++p) {
+        result.insert(std::make_pair(p->x, p->y));
+    }
+    return result;
+}
+
+// The streaming Harris graph (blur, gray, structure tensor, window sum,
+// response and local maxima) should find exactly the points harris() does: zero
+// tolerance, the same set of points. Run twice, so reusing the graph's
+// buffers is covered too.
+int testHarrisGraph() {
+    // Noisy checkerboard, so there are plenty of corners, some near edges
+    cv::Mat image(61, 83, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(40));
+    for (int y = 0; y < image.rows; y++) {
+        for (int x = 0; x < image.cols; x++) {
+            if ((x / 7 + y / 5) % 2) {
+                image.at<cv::Vec3b>(y, x) += cv::Vec3b(150, 120, 180);
+            }
+        }
+    }
+    std::set<std::pair<int, int> > expected = pointSet(harris(image));
+    Graph graph;
+    int failures = 0;
+    for (int run = 0; run < 2; run++) {
+        std::set<std::pair<int, int> > found = pointSet(harris(image, graph));
+        if (found != expected) {
+            failures++;
+        }
+        printf("Harris graph run %d: %d points, harris() %d\n", run,
+               (int)found.size(), (int)expected.size());
+    }
+
+    // The streamed blur and gray alone should match filter() + bgrToGray()
+    // exactly, with the other separable specialized sizes too
+    cv::Mat kernels[] = {
+        gaussianKernel(cv::Size(5, 5)), gaussianKernel(cv::Size(11, 11), 2),
+        gaussianKernel(cv::Size(17, 17), 3), boxKernel(cv::Size(3, 3))
+    };
+    for (size_t k = 0; k < sizeof(kernels)/sizeof(kernels[0]); k++) {
+        cv::Mat gray, reference;
+        bgrToGray(filter(image, kernels[k]), gray);
+        gray.convertTo(reference, CV_32F);
+        Graph blurGray;
+        blurGray.thenFilter(kernels[k], 3).then(new ByteGrayStage);
+        double error = cv::norm(blurGray.run(image), reference, cv::NORM_INF);
+        printf("Graph blur + gray, %dx%d kernel: max error %g\n",
+               kernels[k].rows, kernels[k].cols, error);
+        if (error != 0) {
+            failures++;
+        }
+    }
+    return failures != 0 || expected.empty();
+}
+
+// The unrolled convolutions (and the generic fallback, for the 7x7 kernel)
+// should agree with OpenCV's filter2D up to rounding.
+int testSpecializedConvolution() {
+    cv::Mat image(37, 53, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat kernels[] = {
+        identityKernel(), boxKernel(cv::Size(5, 5)),
+        gaussianKernel(cv::Size(5, 5)), gaussianKernel(cv::Size(11, 11), 2),
+        gaussianKernel(cv::Size(17, 17), 3), dogKernel(cv::Size(5, 5), 0),
+        dogKernel(cv::Size(5, 5), 45), rightShiftKernel(),
+        unsharpKernel(cv::Size(11, 11), 2), gaussianKernel(cv::Size(7, 7))
+    };
+    double worst = 0;
+    for (size_t k = 0; k < sizeof(kernels)/sizeof(kernels[0]); k++) {
+        cv::Mat flipped, floatImage, expected;
+        cv::flip(kernels[k], flipped, -1);
+        image.convertTo(floatImage, CV_32F);
+        cv::filter2D(floatImage, expected, -1, flipped, cv::Point(-1, -1), 0,
+                     cv::BORDER_REPLICATE);
+        expected.convertTo(expected, CV_8UC3);
+        double error = cv::norm(filter(image, kernels[k]), expected,
+                                cv::NORM_INF);
+        worst = std::max(worst, error);
+    }
+    printf("Specialized convolution: worst error %g\n", worst);
+    return worst > 1;
+}
+
+// Once the workspaces have been sized by a first frame, the workspace
+// variants shouldn't touch the heap at all.
+int testWorkspaceAllocations() {
+    cv::Mat frame(120, 160, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat kernel = gaussianKernel(cv::Size(5, 5));
+    FilterWorkspace filterWorkspace;
+    InterestWorkspace interestWorkspace;
+    cv::Mat filtered, separable, edges;
+    PointVector harrisPoints, moravecPoints;
+    size_t before = 0;
+    for (int run = 0; run < 5; run++) {
+        // Runs 0 and 1 are warmup
+        if (run == 2) {
+            before = allocationCount();
+        }
+        filter(frame, kernel, filtered, filterWorkspace);
+        filter(frame, cv::Vec3i(1, 2, 1), cv::Vec3i(1, 2, 1), separable,
+               filterWorkspace);
+        sobel(frame, edges, filterWorkspace);
+        harris(frame, harrisPoints, interestWorkspace);
+        moravec(frame, moravecPoints, interestWorkspace);
+    }
+    size_t allocations = allocationCount() - before;
+    printf("Workspace variants: %zu allocations in 3 frames\n", allocations);
+    if (allocations) {
+        return 1;
+    }
+
+    // And they give the same answers as the allocating versions
+    PointList harrisList = harris(frame);
+    PointList moravecList = moravec(frame);
+    bool same = cv::norm(filtered, filter(frame, kernel), cv::NORM_INF) == 0 &&
+                cv::norm(edges, sobel(frame), cv::NORM_INF) == 0 &&
+                PointVector(harrisList.begin(), harrisList.end()) ==
+                    harrisPoints &&
+                PointVector(moravecList.begin(), moravecList.end()) ==
+                    moravecPoints;
+    if (!same) {
+        printf("Workspace variants disagree with allocating versions\n");
+    }
+    return !same;
+}
+
+// Compact intermediates are exact, so the results shouldn't change at all
+int testCompactStorage() {
+    cv::Mat frame(90, 120, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::GaussianBlur(frame, frame, cv::Size(5, 5), 2);
+    InterestWorkspace full, compact;
+    compact.compact = true;
+    PointVector a, b, c, d;
+    harris(frame, a, full);
+    harris(frame, b, compact);
+    moravec(frame, c, full);
+    moravec(frame, d, compact);
+    FilterWorkspace compactFilter;
+    compactFilter.compact = true;
+    cv::Mat edges;
+    sobel(frame, edges, compactFilter);
+    bool same = a == b && c == d &&
+                cv::norm(edges, sobel(frame), cv::NORM_INF) == 0;
+    printf("Compact storage: %zu/%zu harris, %zu/%zu moravec points, %s\n",
+           b.size(), a.size(), d.size(), c.size(),
+           same ? "identical" : "DIFFERENT");
+    return !same;
+}
+
+// 16-bit images stay 16-bit through cvtColor, so the 3x3 filter has to read
+// its gray image at that depth instead of as bytes
+int testDeepFilter() {
+    cv::Mat frame(40, 50, CV_16UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(65536));
+    cv::Mat gray, expected, result, channel;
+    cv::cvtColor(frame, gray, CV_BGR2GRAY);
+    gray.convertTo(gray, CV_32F);
+    cv::sepFilter2D(gray, expected, CV_32F, cv::Vec3f(1, 0, -1),
+                    cv::Vec3f(1, 2, 1), cv::Point(-1, -1), 0,
+                    cv::BORDER_REPLICATE);
+    FilterWorkspace workspace;
+    workspace.compact = true;
+    filter(frame, cv::Vec3i(1, 2, 1), cv::Vec3i(1, 0, -1), result, workspace);
+    cv::extractChannel(result, channel, 0);
+    double error = cv::norm(channel, expected, cv::NORM_INF);
+    printf("16-bit 3x3 filter: max error %f\n", error);
+    return error > 1e-3;
+}
+
+// Write image as a raw file (in strips of 18 rows, so a 70 row image has a
+// power of two of them), then overwrite size bytes of its
+// header at offset with value. False if the file couldn't be written.
+static bool writeBadRawImage(const char *path, const cv::Mat &image,
+                             size_t offset, const void *value, size_t size) {
+    if (!RawImage::write(path, image, cv::Size(0, 18))) {
+        return false;
+    }
+    FILE *file = fopen(path, "r+b");
+    if (!file) {
+        return false;
+    }
+    bool written = fseek(file, offset, SEEK_SET) == 0 &&
+                   fwrite(value, size, 1, file) == 1;
+    return fclose(file) == 0 && written;
+}
+
+// Raw images should come back exactly as written, with strips mapped in
+// place and smaller tiles reassembled.
+int testRawImage() {
+    const char *path = "test_raw_image.cvraw";
+    cv::Mat image(70, 45, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Size tileSizes[] = { cv::Size(0, 16), cv::Size(16, 16) };
+    int failures = 0;
+    for (int t = 0; t < 2; t++) {
+        RawImage raw;
+        if (!RawImage::write(path, image, tileSizes[t]) || !raw.open(path)) {
+            failures++;
+            continue;
+        }
+        cv::Mat mapped = raw.mat();
+        cv::Mat lastTile = raw.tile(raw.tilesAcross() - 1,
+                                    raw.tilesDown() - 1);
+        // Only strips are mapped in place
+        bool alignedRows = t != 0 || (((size_t)mapped.data % 64) == 0 &&
+                                      mapped.step % 64 == 0);
+        if (mapped.size() != image.size() || mapped.type() != image.type() ||
+            cv::norm(mapped, image, cv::NORM_INF) != 0 || !alignedRows ||
+            ((size_t)lastTile.data % 64) != 0) {
+            failures++;
+        }
+    }
+    // Headers with types that aren't plain Mat types get rejected: flag bits
+    // outside CV_MAT_TYPE_MASK, and depth 7
+    int badTypes[] = { CV_8UC3 | (1 << 14), CV_MAKETYPE(7, 3) };
+    for (int t = 0; t < 2; t++) {
+        RawImage raw;
+        if (!writeBadRawImage(path, image, offsetof(RawImageHeader, type),
+                              &badTypes[t], sizeof(int32_t)) ||
+            raw.open(path)) {
+            failures++;
+        }
+    }
+    // Sizes that only pass the file length check by wrapping around: a
+    // huge width, a row step that wraps when multiplied by the strip
+    // height, and a strip size that wraps when multiplied by the count
+    uint32_t hugeWidth = 0xffffffff;
+    uint64_t hugeSizes[] = { 1ull << 63, 1ull << 62 };
+    size_t hugeOffsets[] = {
+        offsetof(RawImageHeader, tileStep), offsetof(RawImageHeader, tileBytes)
+    };
+    RawImage wide;
+    if (!writeBadRawImage(path, image, offsetof(RawImageHeader, width),
+                          &hugeWidth, sizeof(hugeWidth)) || wide.open(path)) {
+        failures++;
+    }
+    for (int t = 0; t < 2; t++) {
+        RawImage raw;
+        if (!writeBadRawImage(path, image, hugeOffsets[t], &hugeSizes[t],
+                              sizeof(uint64_t)) || raw.open(path)) {
+            failures++;
+        }
+    }
+    remove(path);
+    printf("Raw image round trip: %s\n", failures ? "FAILED" : "ok");
+    return failures != 0;
+}
+
+// The histogram median should match OpenCV's exactly, and the bilateral
+// grid shouldn't change a flat image.
+int testSmoothing() {
+    cv::Mat image(41, 67, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    double medianError = 0;
+    for (int radius = 1; radius <= 4; radius++) {
+        cv::Mat expected;
+        cv::medianBlur(image, expected, 2*radius + 1);
+        medianError = std::max(medianError,
+                               cv::norm(medianFilter(image, radius), expected,
+                                        cv::NORM_INF));
+    }
+    cv::Mat flat(41, 67, CV_8UC3, cv::Scalar(40, 120, 200));
+    double flatError = cv::norm(bilateralGrid(flat, 8, 20), flat,
+                                cv::NORM_INF);
+    printf("Smoothing: median error %g, bilateral flat error %g\n",
+           medianError, flatError);
+    return medianError != 0 || flatError > 1;
+}
+
+// Band by band processing of a raw image should give exactly the in-memory
+// result, with strips smaller than the halo too
+static bool stripsMatch(const char *path, const cv::Mat &expected) {
+    RawImage result;
+    return result.open(path) && result.size() == expected.size() &&
+           cv::norm(result.mat(), expected, cv::NORM_INF) == 0;
+}
+
+int testStripStreaming() {
+    const char *inPath = "test_strips_in.cvraw";
+    const char *outPath = "test_strips_out.cvraw";
+    cv::Mat image(53, 38, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    // 7x7 takes the generic path, 5x5 the specialized one
+    cv::Mat kernels[] = { gaussianKernel(cv::Size(5, 5)),
+                          gaussianKernel(cv::Size(7, 7), 2) };
+    int failures = 0;
+    // Tiles narrower than the image have to be copied into bands
+    RawImage::write(inPath, image, cv::Size(16, 8));
+    for (int stripRows = 2; stripRows <= 32; stripRows *= 4) {
+        RawImage raw;
+        if (!raw.open(inPath)) {
+            failures++;
+            continue;
+        }
+        for (int k = 0; k < 2; k++) {
+            if (!filterStrips(raw, kernels[k], outPath, stripRows) ||
+                !stripsMatch(outPath, filter(image, kernels[k]))) {
+                failures++;
+            }
+        }
+        if (!medianStrips(raw, 3, outPath, stripRows) ||
+            !stripsMatch(outPath, medianFilter(image, 3)) ||
+            !equalHistogramStrips(raw, outPath, stripRows) ||
+            !stripsMatch(outPath, equalHistogram(image))) {
+            failures++;
+        }
+    }
+    remove(inPath);
+    remove(outPath);
+    printf("Strip streaming: %s\n", failures ? "FAILED" : "ok");
+    return failures != 0;
+}
+
 int main(int argc, char *argv[]) {
     int result = 0;
     result |= testGaussian();
+    result |= testColorLut();
+    result |= testColorLutOverflow();
+    result |= testEqualizedLut();
+    result |= testGraphConvolve();
+    result |= testHarrisGraph();
+    result |= testSpecializedConvolution();
+    result |= testWorkspaceAllocations();
+    result |= testCompactStorage();
+    result |= testDeepFilter();
+    result |= testRawImage();
+    result |= testSmoothing();
+    result |= testStripStreaming();
     return result;
 }
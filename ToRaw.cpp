@@ -0,0 +1,51 @@
+// Convert images to the raw tiled format (see RawImage.h), so that tools
+// run over the same images again and again can map them instead of
+// decoding them every time.
+
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RawImage.h"
+
+static void usage(const std::string &program) {
+    std::cerr << "Usage: " << program
+              << " [-t tile width tile height] [input image] [output file]"
+              << " ...\n"
+              << "Tiles default to strips of 64 rows; a tile width of 0 "
+              << "means the image width.\n";
+}
+
+int main(int argc, char *argv[]) {
+    cv::Size tileSize(0, 64);
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "-t") == 0) {
+        if (argc < 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        tileSize = cv::Size(atoi(argv[2]), atoi(argv[3]));
+        first = 4;
+    }
+    if (argc - first < 2 || (argc - first) % 2 != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int failures = 0;
+    for (int i = first; i < argc; i += 2) {
+        // Decoded the way the tools decode images, as 8-bit BGR
+        cv::Mat image = cv::imread(argv[i]);
+        if (!image.data) {
+            std::cerr << "imread: " << argv[i] << ": didn't work out\n";
+            failures++;
+            continue;
+        }
+        if (!RawImage::write(argv[i+1], image, tileSize)) {
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,196 @@
+#include "Trace.h"
+
+#ifdef CV_TRACING
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// Events per thread before the oldest ones get overwritten
+#define TRACE_RING_SIZE (1 << 16)
+
+struct TraceEvent {
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+    double value;   // counters only
+    bool isCounter;
+};
+
+struct TraceRing {
+    TraceRing(int id) : id(id), next(0), events(TRACE_RING_SIZE) {}
+
+    void push(const TraceEvent &event) {
+        events[next % TRACE_RING_SIZE] = event;
+        next++;
+    }
+
+    int id;
+    uint64_t next;
+    std::vector<TraceEvent> events;
+};
+
+// Everything that has to outlive the threads doing the tracing
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<TraceStage *> stages;
+    std::vector<std::unique_ptr<TraceRing> > rings;
+    std::chrono::steady_clock::time_point epoch;
+};
+
+static void dumpTrace();
+
+static TraceRegistry &registry() {
+    // Leaked on purpose so it's still around when dumpTrace runs at exit
+    static TraceRegistry *instance = NULL;
+    static std::once_flag once;
+    std::call_once(once, []() {
+        instance = new TraceRegistry;
+        instance->epoch = std::chrono::steady_clock::now();
+        // Any program dumps when asked to through the environment
+        if (getenv("CV_TRACE_FILE")) {
+            traceDumpAtExit();
+        }
+    });
+    return *instance;
+}
+
+void traceDumpAtExit() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+        atexit(dumpTrace);
+    });
+}
+
+static TraceRing &threadRing() {
+    static thread_local TraceRing *ring = NULL;
+    if (!ring) {
+        TraceRegistry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.rings.push_back(std::unique_ptr<TraceRing>(
+                              new TraceRing(r.rings.size() + 1)));
+        ring = r.rings.back().get();
+    }
+    return *ring;
+}
+
+uint64_t traceNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - registry().epoch).count();
+}
+
+static int bucketFor(uint64_t ns) {
+    if (ns < 4) {
+        return ns;
+    }
+    int log = 63 - __builtin_clzll(ns);
+    int bucket = log * 4 + ((ns >> (log - 2)) & 3);
+    return std::min(bucket, TraceStage::BUCKETS - 1);
+}
+
+// Upper bound of a bucket, in nanoseconds
+static double bucketLimit(int bucket) {
+    if (bucket < 4) {
+        return bucket + 1;
+    }
+    int log = bucket / 4;
+    return (double)((5 + bucket % 4) * (1ull << (log - 2)));
+}
+
+TraceStage::TraceStage(const char *name) : name(name), count(0), total(0) {
+    for (int i = 0; i < BUCKETS; i++) {
+        buckets[i] = 0;
+    }
+    TraceRegistry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.stages.push_back(this);
+}
+
+void TraceStage::record(uint64_t start, uint64_t duration) {
+    count.fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(duration, std::memory_order_relaxed);
+    buckets[bucketFor(duration)].fetch_add(1, std::memory_order_relaxed);
+    TraceEvent event = { name, start, duration, 0, false };
+    threadRing().push(event);
+}
+
+TraceScope::TraceScope(TraceStage &stage) : stage(stage), start(traceNow()) {
+}
+
+TraceScope::~TraceScope() {
+    stage.record(start, traceNow() - start);
+}
+
+void traceCounter(const char *name, double value) {
+    TraceEvent event = { name, traceNow(), 0, value, true };
+    threadRing().push(event);
+}
+
+static double percentileOf(const TraceStage &stage, double p) {
+    uint64_t target = (uint64_t)(p * stage.count);
+    uint64_t seen = 0;
+    for (int i = 0; i < TraceStage::BUCKETS; i++) {
+        seen += stage.buckets[i];
+        if (seen > target) {
+            return bucketLimit(i);
+        }
+    }
+    return bucketLimit(TraceStage::BUCKETS - 1);
+}
+
+static void dumpTrace() {
+    TraceRegistry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    const char *path = getenv("CV_TRACE_FILE");
+    if (!path) {
+        path = "trace.json";
+    }
+    std::ofstream out(path);
+    out << "{\"traceEvents\": [\n";
+    bool first = true;
+    for (size_t i = 0; i < r.rings.size(); i++) {
+        const TraceRing &ring = *r.rings[i];
+        uint64_t begin = ring.next > TRACE_RING_SIZE ?
+                         ring.next - TRACE_RING_SIZE : 0;
+        for (uint64_t n = begin; n < ring.next; n++) {
+            const TraceEvent &e = ring.events[n % TRACE_RING_SIZE];
+            out << (first ? "" : ",\n");
+            first = false;
+            // Chrome wants microseconds
+            out << "{\"name\": \"" << e.name << "\", \"pid\": 1, \"tid\": "
+                << ring.id << ", \"ts\": " << e.start / 1000.0;
+            if (e.isCounter) {
+                out << ", \"ph\": \"C\", \"args\": {\"value\": " << e.value
+                    << "}}";
+            } else {
+                out << ", \"ph\": \"X\", \"dur\": " << e.duration / 1000.0
+                    << "}";
+            }
+        }
+    }
+    out << "\n]}\n";
+    if (!out) {
+        fprintf(stderr, "trace: couldn't write %s\n", path);
+    }
+
+    fprintf(stderr, "\n%-28s %8s %10s %10s %10s %10s\n", "stage (ms)",
+            "count", "mean", "p50", "p90", "p99");
+    for (size_t i = 0; i < r.stages.size(); i++) {
+        const TraceStage &s = *r.stages[i];
+        if (s.count == 0) {
+            continue;
+        }
+        fprintf(stderr, "%-28s %8llu %10.3f %10.3f %10.3f %10.3f\n", s.name,
+                (unsigned long long)s.count.load(),
+                s.total / 1e6 / s.count, percentileOf(s, 0.5) / 1e6,
+                percentileOf(s, 0.9) / 1e6, percentileOf(s, 0.99) / 1e6);
+    }
+}
+
+#endif
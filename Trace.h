@@ -0,0 +1,75 @@
+#ifndef __CV_TRACE_H__
+#define __CV_TRACE_H__
+
+// Stage-level tracing for finding out where a frame's time goes.
+//
+// Mark stages with TRACE_SCOPE("harris/response") (times the rest of the
+// enclosing block) and values with TRACE_COUNTER("harris/points", n). Events
+// go into per-thread ring buffers. Programs that call TRACE_DUMP_AT_EXIT(),
+// or any program run with $CV_TRACE_FILE set, write them out at exit as
+// Chrome trace-event JSON (load in chrome://tracing or Perfetto) to
+// $CV_TRACE_FILE (default trace.json), with per-stage latency histograms on
+// stderr. Others (tests, benchmarks) leave no files behind.
+//
+// Only enabled when built with CV_TRACING defined (cmake -DTRACING=ON);
+// otherwise the macros expand to nothing.
+
+#ifdef CV_TRACING
+
+#include <atomic>
+#include <stdint.h>
+
+// Per call site statistics (histogram buckets are quarter powers of two of
+// nanoseconds, so about 19% resolution).
+class TraceStage {
+
+  public:
+    TraceStage(const char *name);
+
+    void record(uint64_t start, uint64_t duration);
+
+    static const int BUCKETS = 160;
+
+    const char *name;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> buckets[BUCKETS];
+};
+
+class TraceScope {
+
+  public:
+    TraceScope(TraceStage &stage);
+    ~TraceScope();
+
+  private:
+    TraceStage &stage;
+    uint64_t start;
+};
+
+// Nanoseconds since tracing started
+uint64_t traceNow();
+
+void traceCounter(const char *name, double value);
+
+// Write the trace and the histograms when the program exits
+void traceDumpAtExit();
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    static TraceStage TRACE_CONCAT(traceStage, __LINE__)(name); \
+    TraceScope TRACE_CONCAT(traceScope, __LINE__)( \
+        TRACE_CONCAT(traceStage, __LINE__))
+#define TRACE_COUNTER(name, value) traceCounter(name, value)
+#define TRACE_DUMP_AT_EXIT() traceDumpAtExit()
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_COUNTER(name, value)
+#define TRACE_DUMP_AT_EXIT()
+
+#endif
+
+#endif
@@ -0,0 +1,149 @@
+#include "VideoPipeline.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "Trace.h"
+
+// Every job is in exactly one place: free, pending (decoded, waiting for a
+// worker), with a worker, done (waiting for its turn to be written) or
+// with the writer.
+struct PipelineState {
+    std::mutex mutex;
+    std::condition_variable freed;     // a job went back on the free list
+    std::condition_variable queued;    // a job was decoded
+    std::condition_variable finished;  // a job was processed
+    std::vector<FrameJob> jobs;
+    std::vector<FrameJob *> free;
+    std::deque<FrameJob *> pending;
+    std::map<int, FrameJob *> done;
+    int decoded = 0;
+    bool decodingDone = false;
+    bool stopping = false;
+};
+
+static void decodeFrames(cv::VideoCapture &capture, PipelineState &state) {
+    for (int index = 0; ; index++) {
+        FrameJob *job;
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.freed.wait(lock, [&state] {
+                return !state.free.empty() || state.stopping;
+            });
+            if (state.stopping) {
+                break;
+            }
+            job = state.free.back();
+            state.free.pop_back();
+        }
+        bool ok;
+        {
+            TRACE_SCOPE("decode");
+            ok = capture.read(job->frame) && !job->frame.empty();
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (!ok) {
+            state.free.push_back(job);
+            break;
+        }
+        job->index = index;
+        state.pending.push_back(job);
+        state.decoded = index + 1;
+        state.queued.notify_one();
+    }
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.decodingDone = true;
+    state.queued.notify_all();
+    state.finished.notify_all();
+}
+
+static void processFrames(PipelineState &state, const FrameProcessor &process,
+                          int worker) {
+    while (true) {
+        FrameJob *job;
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.queued.wait(lock, [&state] {
+                return !state.pending.empty() || state.decodingDone ||
+                       state.stopping;
+            });
+            if (state.stopping || state.pending.empty()) {
+                return;
+            }
+            job = state.pending.front();
+            state.pending.pop_front();
+        }
+        {
+            TRACE_SCOPE("process");
+            process(*job, worker);
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.done[job->index] = job;
+        state.finished.notify_all();
+    }
+}
+
+int processVideo(cv::VideoCapture &capture, int workers, int window,
+                 const FrameProcessor &process, const FrameWriter &write) {
+    workers = std::max(workers, 1);
+    window = std::max(window, 1);
+    PipelineState state;
+    state.jobs.resize(window);
+    for (int i = 0; i < window; i++) {
+        state.free.push_back(&state.jobs[i]);
+    }
+
+    std::thread decoder(decodeFrames, std::ref(capture), std::ref(state));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++) {
+        threads.push_back(std::thread(processFrames, std::ref(state),
+                                      std::cref(process), i));
+    }
+
+    // Write frames in order as they come in
+    int written = 0;
+    while (true) {
+        FrameJob *job;
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.finished.wait(lock, [&state, written] {
+                return state.done.count(written) ||
+                       (state.decodingDone && written == state.decoded);
+            });
+            if (!state.done.count(written)) {
+                break; // that was the last one
+            }
+            job = state.done[written];
+            state.done.erase(written);
+        }
+        bool ok;
+        {
+            TRACE_SCOPE("write");
+            ok = write(*job);
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.free.push_back(job);
+        state.freed.notify_one();
+        if (!ok) {
+            state.stopping = true;
+            state.freed.notify_all();
+            state.queued.notify_all();
+            break;
+        }
+        written++;
+    }
+
+    decoder.join();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    return written;
+}
+
+int defaultWorkers() {
+    return std::max((int)std::thread::hardware_concurrency(), 1);
+}
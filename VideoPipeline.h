@@ -0,0 +1,40 @@
+#ifndef __CV_VIDEO_PIPELINE_H__
+#define __CV_VIDEO_PIPELINE_H__
+
+#include <opencv2/opencv.hpp>
+
+#include <functional>
+#include <vector>
+
+// Offline (as fast as possible, not real time) video processing: one thread
+// decodes ahead, a pool of workers processes whole frames in parallel, and
+// the results are handed back in frame order.
+
+// One frame's worth of work. Jobs (and their Mats) are recycled for later
+// frames, so processing should write into result and points rather than
+// replace them, to avoid allocating per frame.
+struct FrameJob {
+    int index;                      // frame number, from 0
+    cv::Mat frame;                  // decoded input
+    cv::Mat result;                 // output image, if any
+    std::vector<cv::Point> points;  // output points, if any
+};
+
+// Runs on a worker thread; worker (0 .. workers-1) identifies the thread,
+// e.g. to pick a per-thread workspace.
+typedef std::function<void(FrameJob &job, int worker)> FrameProcessor;
+
+// Runs on the calling thread, in frame order. Return false to stop early.
+typedef std::function<bool(const FrameJob &job)> FrameWriter;
+
+// Process every frame of capture with workers threads and write the results
+// in order. At most window frames are in flight at a time (decoded but not
+// written yet), which bounds the memory use. Returns the number of frames
+// written.
+int processVideo(cv::VideoCapture &capture, int workers, int window,
+                 const FrameProcessor &process, const FrameWriter &write);
+
+// Worker count to use by default: one per core
+int defaultWorkers();
+
+#endif